@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui xml
+QT       += core gui xml network concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -33,7 +33,18 @@ SOURCES += \
         mainwindow.cpp \
     gamesessioneditor.cpp \
     saveutil.cpp \
-    gamesession.cpp
+    gamesession.cpp \
+    batchio.cpp \
+    editjournal.cpp \
+    zcodec.cpp \
+    sublibrary.cpp \
+    savedaemon.cpp \
+    thumbnailcache.cpp \
+    saveindex.cpp \
+    memoryaccounting.cpp \
+    payloadstore.cpp \
+    locationindex.cpp \
+    subimport.cpp
 
 HEADERS += \
         mainwindow.h \
@@ -43,7 +54,18 @@ HEADERS += \
     vendor/gzip-cpp/config.hpp \
     vendor/gzip-cpp/compress.hpp \
     fileutils.h \
-    gamesession.h
+    gamesession.h \
+    batchio.h \
+    editjournal.h \
+    zcodec.h \
+    sublibrary.h \
+    savedaemon.h \
+    thumbnailcache.h \
+    saveindex.h \
+    memoryaccounting.h \
+    payloadstore.h \
+    locationindex.h \
+    subimport.h
 
 FORMS += \
         mainwindow.ui \
@@ -51,6 +73,17 @@ FORMS += \
 
 LIBS += -lz
 
+# Batch file I/O through io_uring, enable with: qmake CONFIG+=io_uring
+linux:io_uring {
+    DEFINES += SAVEEDITOR_IO_URING
+    LIBS += -luring
+}
+
+# Count operator new allocations per pipeline stage, enable with: qmake CONFIG+=memory_accounting
+memory_accounting {
+    DEFINES += SAVEEDITOR_MEMORY_ACCOUNTING
+}
+
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
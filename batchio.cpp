@@ -0,0 +1,433 @@
+#include "batchio.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#ifdef SAVEEDITOR_IO_URING
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+size_t alignUp(size_t size) {
+    return (size + BatchIO::alignment - 1) & ~(BatchIO::alignment - 1);
+}
+
+BatchIO::Options& defaultOptionsRef() {
+    static BatchIO::Options options;
+    return options;
+}
+
+// Remember the first error reported by any worker thread
+class ErrorSlot
+{
+public:
+    void set(std::string const& message) {
+        QMutexLocker lock(&mutex);
+        if (error.empty())
+            error = message;
+    }
+    void throwIfSet() {
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
+private:
+    QMutex mutex;
+    std::string error;
+};
+
+// Worker threads shared by all pooled batches, kept alive between batches
+QThreadPool& ioPool(unsigned queueDepth) {
+    static QThreadPool pool;
+    static QMutex mutex;
+    QMutexLocker lock(&mutex);
+    int threads = static_cast<int>(std::max(1u, queueDepth));
+    if (pool.maxThreadCount() < threads)
+        pool.setMaxThreadCount(threads);
+    pool.setExpiryTimeout(-1);
+    return pool;
+}
+
+void writeOne(BatchIO::WriteRequest const& request, ErrorSlot& error) {
+    QFile outFile(request.path);
+    if (!outFile.open(QFile::WriteOnly | QFile::Truncate)) {
+        error.set("Could not open file \"" + request.path.toStdString() + "\" for writing");
+        return;
+    }
+    qint64 written = outFile.write(request.data, static_cast<qint64>(request.size));
+    if (written != static_cast<qint64>(request.size))
+        error.set("Write failed (not enough data written) when saving \"" + request.path.toStdString() + "\"");
+}
+
+void readOne(BatchIO::ReadRequest& request, ErrorSlot& error) {
+    QFile inFile(request.path);
+    if (!inFile.open(QFile::ReadOnly)) {
+        error.set("Could not open file \"" + request.path.toStdString() + "\" for reading");
+        return;
+    }
+    size_t size = static_cast<size_t>(inFile.size());
+    try {
+        request.buffer = AlignedBuffer(size);
+    } catch (std::runtime_error const& e) {
+        error.set(e.what());
+        return;
+    }
+    qint64 read = inFile.read(request.buffer.data(), static_cast<qint64>(size));
+    if (read != static_cast<qint64>(size))
+        error.set("Read failed (not enough data read) from \"" + request.path.toStdString() + "\"");
+}
+
+#ifdef SAVEEDITOR_IO_URING
+// Part of a file transfer submitted as one io_uring operation
+struct UringChunk {
+    int fd;
+    char* buf;
+    size_t offset;
+    size_t length;
+    size_t end; // real file size, reads past it are expected to come back short
+    const QString* path;
+};
+
+/* Cancel operations still in flight and reap their completions
+ * The kernel may use the buffers until the completion arrives, so the caller
+ * can only free them (and close the files) after this returns.
+ */
+void drainRing(io_uring& ring, std::unordered_set<UringChunk*>& inFlight) {
+    for (UringChunk* chunk: inFlight) {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr) {
+            io_uring_submit(&ring);
+            sqe = io_uring_get_sqe(&ring);
+        }
+        if (sqe == nullptr)
+            break; // operations that aren't cancelled still complete
+        io_uring_prep_cancel(sqe, chunk, 0);
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+    if (io_uring_submit(&ring) < 0) {
+        // operations stuck in the submission queue would never complete, leave them to io_uring_queue_exit
+        inFlight.clear();
+        return;
+    }
+    while (!inFlight.empty()) {
+        io_uring_cqe* cqe;
+        int ret = io_uring_wait_cqe(&ring, &cqe);
+        if (ret == -EINTR || ret == -EAGAIN)
+            continue;
+        if (ret < 0) {
+            // completions can't be reaped, leak the chunks rather than free memory the kernel may write to
+            inFlight.clear();
+            return;
+        }
+        UringChunk* chunk = static_cast<UringChunk*>(io_uring_cqe_get_data(cqe));
+        io_uring_cqe_seen(&ring, cqe);
+        if (chunk) { // null for completions of the cancel requests
+            inFlight.erase(chunk);
+            delete chunk;
+        }
+    }
+}
+
+/* Push chunks through the ring keeping up to depth operations in flight
+ * Short transfers are requeued for the remaining bytes.
+ * Nothing is left in flight when this returns, even on failure.
+ * @returns std::string: error message, empty on success
+ */
+std::string runRing(io_uring& ring, unsigned depth, std::deque<UringChunk>& pending, bool write) {
+    std::string error;
+    std::unordered_set<UringChunk*> inFlight;
+    while (!pending.empty() || !inFlight.empty()) {
+        while (error.empty() && !pending.empty() && inFlight.size() < depth) {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            if (sqe == nullptr)
+                break;
+            UringChunk* chunk = new UringChunk(pending.front());
+            pending.pop_front();
+            unsigned length = static_cast<unsigned>(chunk->length);
+            if (write)
+                io_uring_prep_write(sqe, chunk->fd, chunk->buf, length, chunk->offset);
+            else
+                io_uring_prep_read(sqe, chunk->fd, chunk->buf, length, chunk->offset);
+            io_uring_sqe_set_data(sqe, chunk);
+            inFlight.insert(chunk);
+        }
+        if (!error.empty())
+            pending.clear();
+        if (inFlight.empty())
+            break;
+
+        int ret = io_uring_submit_and_wait(&ring, 1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            drainRing(ring, inFlight);
+            return std::string("io_uring submission failed: ") + strerror(-ret);
+        }
+
+        io_uring_cqe* cqe;
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            std::unique_ptr<UringChunk> chunk(static_cast<UringChunk*>(io_uring_cqe_get_data(cqe)));
+            int res = cqe->res;
+            seen++;
+            inFlight.erase(chunk.get());
+            if (res == -EINTR || res == -EAGAIN) {
+                pending.push_front(*chunk);
+            } else if (res < 0) {
+                if (error.empty())
+                    error = std::string(write ? "Write" : "Read") + " failed (" + strerror(-res) +
+                            ") for \"" + chunk->path->toStdString() + "\"";
+            } else if (!write && chunk->offset + static_cast<size_t>(res) >= chunk->end) {
+                // reached the end of file, aligned reads may ask for more than there is
+            } else if (res == 0) {
+                if (error.empty())
+                    error = std::string(write ? "Write" : "Read") +
+                            " failed (not enough data transferred) for \"" + chunk->path->toStdString() + "\"";
+            } else if (static_cast<size_t>(res) < chunk->length) {
+                chunk->buf += res;
+                chunk->offset += static_cast<size_t>(res);
+                chunk->length -= static_cast<size_t>(res);
+                pending.push_front(*chunk);
+            }
+        }
+        io_uring_cq_advance(&ring, seen);
+    }
+    return error;
+}
+
+// Split a transfer of length bytes into chunks of at most chunkSize
+void queueChunks(std::deque<UringChunk>& pending, int fd, char* buf, size_t length,
+                 size_t end, size_t chunkSize, const QString* path) {
+    for (size_t offset = 0; offset < length; offset += chunkSize) {
+        size_t chunkLen = std::min(chunkSize, length - offset);
+        pending.push_back(UringChunk{fd, buf + offset, offset, chunkLen, end, path});
+    }
+}
+
+// Open a file, preferring O_DIRECT when requested and supported by the filesystem
+// @param direct: set to true when the descriptor was opened with O_DIRECT
+int openFile(QString const& path, int flags, bool tryDirect, bool& direct) {
+    QByteArray encoded = QFile::encodeName(path);
+    direct = false;
+    if (tryDirect) {
+        int fd = ::open(encoded.constData(), flags | O_DIRECT | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            direct = true;
+            return fd;
+        }
+    }
+    return ::open(encoded.constData(), flags | O_CLOEXEC, 0644);
+}
+#endif
+
+} // namespace
+
+AlignedBuffer::AlignedBuffer(size_t size) :
+    buffer(static_cast<char*>(qMallocAligned(alignUp(std::max<size_t>(size, 1)), BatchIO::alignment))),
+    length(size),
+    allocated(alignUp(std::max<size_t>(size, 1)))
+{
+    if (!buffer)
+        throw std::runtime_error("Could not allocate " + std::to_string(size) + " bytes of I/O buffer");
+}
+
+// Shrink the visible size of the buffer, capacity is kept
+void AlignedBuffer::truncate(size_t size) {
+    length = std::min(size, length);
+}
+
+void AlignedBuffer::Deleter::operator()(char* ptr) const {
+    qFreeAligned(ptr);
+}
+
+BatchIO::Options BatchIO::defaultOptions() {
+    return defaultOptionsRef();
+}
+
+// Set options used by SaveUtil, call before starting any I/O
+void BatchIO::setDefaultOptions(const Options &options) {
+    defaultOptionsRef() = options;
+}
+
+// @returns bool: true if batches will be submitted through io_uring
+bool BatchIO::ioUringAvailable() {
+#ifdef SAVEEDITOR_IO_URING
+    static const bool available = []() {
+        io_uring ring;
+        if (io_uring_queue_init(1, &ring, 0) < 0)
+            return false;
+        io_uring_queue_exit(&ring);
+        return true;
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+/* Write every request to its file, truncating existing files
+ * @throws std::runtime_error: when any of the files could not be written
+ */
+void BatchIO::writeFiles(const std::vector<WriteRequest> &requests, Options const& options) {
+    if (requests.empty())
+        return;
+#ifdef SAVEEDITOR_IO_URING
+    if (ioUringAvailable() && writeFilesUring(requests, options))
+        return;
+#endif
+    writeFilesPooled(requests, options);
+}
+
+/* Read whole files into request buffers
+ * @throws std::runtime_error: when any of the files could not be read
+ */
+void BatchIO::readFiles(std::vector<ReadRequest> &requests, Options const& options) {
+    if (requests.empty())
+        return;
+#ifdef SAVEEDITOR_IO_URING
+    if (ioUringAvailable() && readFilesUring(requests, options))
+        return;
+#endif
+    readFilesPooled(requests, options);
+}
+
+#ifdef SAVEEDITOR_IO_URING
+// @returns bool: false if the ring could not be set up and nothing was written
+bool BatchIO::writeFilesUring(const std::vector<WriteRequest> &requests, Options const& options) {
+    unsigned depth = std::max(1u, options.queueDepth);
+    io_uring ring;
+    if (io_uring_queue_init(depth, &ring, 0) < 0)
+        return false;
+
+    size_t chunkSize = alignUp(options.chunkSize);
+    std::vector<int> fds(requests.size(), -1);
+    std::vector<bool> padded(requests.size(), false);
+    std::vector<AlignedBuffer> bounceBuffers; // O_DIRECT needs aligned source memory
+    std::deque<UringChunk> pending;
+    std::string error;
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        WriteRequest const& request = requests[i];
+        bool direct;
+        int fd = openFile(request.path, O_WRONLY | O_CREAT | O_TRUNC, options.directIO, direct);
+        if (fd < 0) {
+            error = "Could not open file \"" + request.path.toStdString() + "\" for writing";
+            break;
+        }
+        fds[i] = fd;
+        if (direct) {
+            // O_DIRECT transfers whole blocks, the padding is cut off with ftruncate afterwards
+            bounceBuffers.emplace_back(request.size);
+            AlignedBuffer& bounce = bounceBuffers.back();
+            memcpy(bounce.data(), request.data, request.size);
+            memset(bounce.data() + request.size, 0, bounce.capacity() - request.size);
+            padded[i] = alignUp(request.size) != request.size;
+            queueChunks(pending, fd, bounce.data(), alignUp(request.size), request.size, chunkSize, &request.path);
+        } else {
+            queueChunks(pending, fd, const_cast<char*>(request.data), request.size, request.size, chunkSize, &request.path);
+        }
+    }
+
+    if (error.empty())
+        error = runRing(ring, depth, pending, true);
+    io_uring_queue_exit(&ring);
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] < 0)
+            continue;
+        if (padded[i] && ftruncate(fds[i], static_cast<off_t>(requests[i].size)) != 0 && error.empty())
+            error = "Could not truncate \"" + requests[i].path.toStdString() + "\"";
+        ::close(fds[i]);
+    }
+    if (!error.empty())
+        throw std::runtime_error(error);
+    return true;
+}
+
+// @returns bool: false if the ring could not be set up and nothing was read
+bool BatchIO::readFilesUring(std::vector<ReadRequest> &requests, Options const& options) {
+    unsigned depth = std::max(1u, options.queueDepth);
+    io_uring ring;
+    if (io_uring_queue_init(depth, &ring, 0) < 0)
+        return false;
+
+    size_t chunkSize = alignUp(options.chunkSize);
+    std::vector<int> fds(requests.size(), -1);
+    std::deque<UringChunk> pending;
+    std::string error;
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        ReadRequest& request = requests[i];
+        bool direct;
+        int fd = openFile(request.path, O_RDONLY, options.directIO, direct);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0)
+                ::close(fd);
+            error = "Could not open file \"" + request.path.toStdString() + "\" for reading";
+            break;
+        }
+        fds[i] = fd;
+        size_t size = static_cast<size_t>(st.st_size);
+        request.buffer = AlignedBuffer(size);
+        size_t length = direct ? alignUp(size) : size;
+        queueChunks(pending, fd, request.buffer.data(), length, size, chunkSize, &request.path);
+    }
+
+    if (error.empty())
+        error = runRing(ring, depth, pending, false);
+    io_uring_queue_exit(&ring);
+
+    for (int fd: fds) {
+        if (fd >= 0)
+            ::close(fd);
+    }
+    if (!error.empty())
+        throw std::runtime_error(error);
+    return true;
+}
+#endif
+
+void BatchIO::writeFilesPooled(const std::vector<WriteRequest> &requests, Options const& options) {
+    QThreadPool& pool = ioPool(options.queueDepth);
+    QSemaphore finished;
+    ErrorSlot error;
+    for (WriteRequest const& request: requests) {
+        pool.start([&request, &error, &finished]() {
+            writeOne(request, error);
+            finished.release();
+        });
+    }
+    finished.acquire(static_cast<int>(requests.size()));
+    error.throwIfSet();
+}
+
+void BatchIO::readFilesPooled(std::vector<ReadRequest> &requests, Options const& options) {
+    QThreadPool& pool = ioPool(options.queueDepth);
+    QSemaphore finished;
+    ErrorSlot error;
+    for (ReadRequest& request: requests) {
+        pool.start([&request, &error, &finished]() {
+            readOne(request, error);
+            finished.release();
+        });
+    }
+    finished.acquire(static_cast<int>(requests.size()));
+    error.throwIfSet();
+}
@@ -0,0 +1,76 @@
+#ifndef BATCHIO_H
+#define BATCHIO_H
+
+#include <QString>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Heap buffer aligned for O_DIRECT transfers, capacity is rounded up to BatchIO::alignment
+class AlignedBuffer
+{
+public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t size);
+
+    char* data() { return buffer.get(); }
+    const char* data() const { return buffer.get(); }
+    size_t size() const { return length; }
+    size_t capacity() const { return allocated; }
+    void truncate(size_t size);
+
+private:
+    struct Deleter {
+        void operator()(char* ptr) const;
+    };
+    std::unique_ptr<char, Deleter> buffer;
+    size_t length = 0;
+    size_t allocated = 0;
+};
+
+/* Batched file reads/writes used by SaveUtil
+ * On Linux builds configured with CONFIG+=io_uring the whole batch is submitted
+ * through io_uring, otherwise (or when the kernel refuses io_uring) requests are
+ * spread over a thread pool.
+ */
+class BatchIO
+{
+public:
+    struct WriteRequest {
+        QString path;
+        const char* data;
+        size_t size;
+    };
+
+    struct ReadRequest {
+        QString path;
+        AlignedBuffer buffer; // filled by readFiles
+    };
+
+    struct Options {
+        unsigned queueDepth = 64;   // max operations in flight
+        size_t chunkSize = 1 << 22; // split large files into chunks of this size
+        bool directIO = false;      // bypass page cache (io_uring backend only)
+    };
+
+    static constexpr size_t alignment = 4096;
+
+    BatchIO() = delete;
+    static void writeFiles(std::vector<WriteRequest> const& requests, Options const& options = defaultOptions());
+    static void readFiles(std::vector<ReadRequest>& requests, Options const& options = defaultOptions());
+
+    static Options defaultOptions();
+    static void setDefaultOptions(Options const& options);
+    static bool ioUringAvailable();
+
+private:
+#ifdef SAVEEDITOR_IO_URING
+    static bool writeFilesUring(std::vector<WriteRequest> const& requests, Options const& options);
+    static bool readFilesUring(std::vector<ReadRequest>& requests, Options const& options);
+#endif
+    static void writeFilesPooled(std::vector<WriteRequest> const& requests, Options const& options);
+    static void readFilesPooled(std::vector<ReadRequest>& requests, Options const& options);
+};
+
+#endif // BATCHIO_H
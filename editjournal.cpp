@@ -0,0 +1,409 @@
+#include "editjournal.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QUrl>
+
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include <batchio.h>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const QString journalFileName = "session.journal";
+static const QString blobDirName = "blobs";
+static const QString checkpointFileName = "checkpoint.save";
+static const QString blobTempSuffix = ".part";
+static const QByteArray journalMagic = "BSEJOURNAL 1";
+static const int groupCommitRecords = 64; // commit early when this many records are waiting
+static const int defaultCommitInterval = 250; // msec
+
+static QByteArray encodeField(QString const& field) {
+    return QUrl::toPercentEncoding(field);
+}
+
+static QString decodeField(QByteArray const& field) {
+    return QUrl::fromPercentEncoding(field);
+}
+
+static QByteArray subTypeToken(GameSession::SubmarineType type) {
+    return type == GameSession::OwnedSubmarine ? "owned" : "available";
+}
+
+static const QByteArray locationActionTokens[] = {"reputation", "balance", "restock"};
+
+static QByteArray encodeNumber(double value) {
+    return QByteArray::number(value, 'g', 17);
+}
+
+// "locations\t<action>\t<value>\t<item>\t<type>\t<name>\t<center x>\t<center y>\t<radius>"
+static QByteArray locationEditPayload(LocationIndex::Edit const& edit) {
+    LocationIndex::Filter const& filter = edit.filter;
+    return "locations\t" + locationActionTokens[edit.action] + '\t' + encodeNumber(edit.value) + '\t' +
+            encodeField(edit.item) + '\t' + encodeField(filter.type) + '\t' + encodeField(filter.name) + '\t' +
+            encodeNumber(filter.center.x()) + '\t' + encodeNumber(filter.center.y()) + '\t' + encodeNumber(filter.radius);
+}
+
+static bool parseLocationEdit(QList<QByteArray> const& fields, LocationIndex::Edit& edit) {
+    if (fields.size() != 9)
+        return false;
+    bool found = false;
+    for (int i = 0; i < 3; i++) {
+        if (fields.at(1) == locationActionTokens[i]) {
+            edit.action = static_cast<LocationIndex::Edit::Action>(i);
+            found = true;
+        }
+    }
+    bool ok[4];
+    edit.value = fields.at(2).toDouble(&ok[0]);
+    edit.item = decodeField(fields.at(3));
+    edit.filter.type = decodeField(fields.at(4));
+    edit.filter.name = decodeField(fields.at(5));
+    edit.filter.center = QPointF(fields.at(6).toDouble(&ok[1]), fields.at(7).toDouble(&ok[2]));
+    edit.filter.radius = fields.at(8).toDouble(&ok[3]);
+    return found && ok[0] && ok[1] && ok[2] && ok[3];
+}
+
+static quint32 checksum(QByteArray const& payload) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(payload.constData()), static_cast<uInt>(payload.size()));
+    return static_cast<quint32>(crc);
+}
+
+// Journal line: "<crc32 of payload>\t<payload>\n"
+static QByteArray makeLine(QByteArray const& payload) {
+    return QByteArray::number(checksum(payload), 16).rightJustified(8, '0') + '\t' + payload + '\n';
+}
+
+// @returns bool: false when the line is torn or corrupted
+static bool parseLine(QByteArray line, QByteArray& payload) {
+    if (!line.endsWith('\n'))
+        return false;
+    line.chop(1);
+    int sep = line.indexOf('\t');
+    if (sep != 8)
+        return false;
+    bool ok;
+    quint32 crc = line.left(sep).toUInt(&ok, 16);
+    payload = line.mid(sep + 1);
+    return ok && crc == checksum(payload);
+}
+
+static bool parseRecord(QByteArray const& payload, EditJournal::Record& record) {
+    QList<QByteArray> fields = payload.split('\t');
+    QByteArray const& kind = fields.at(0);
+    if (kind == "money" && fields.size() == 2) {
+        bool ok;
+        qint64 amount = fields.at(1).toLongLong(&ok);
+        record.type = EditJournal::Record::SessionEdit;
+        record.edit = GameSession::Edit::setMoney(amount);
+        return ok;
+    }
+    if ((kind == "add" || kind == "remove") && fields.size() == 3) {
+        GameSession::SubmarineType type = fields.at(1) == "owned" ?
+                    GameSession::OwnedSubmarine : GameSession::AvailableSubmarine;
+        QString name = decodeField(fields.at(2));
+        record.type = EditJournal::Record::SessionEdit;
+        record.edit = kind == "add" ?
+                    GameSession::Edit::addSubmarine(name, type) :
+                    GameSession::Edit::removeSubmarine(name, type);
+        return true;
+    }
+    if (kind == "locations") {
+        LocationIndex::Edit edit;
+        record.type = EditJournal::Record::SessionEdit;
+        if (!parseLocationEdit(fields, edit))
+            return false;
+        record.edit = GameSession::Edit::editLocations(edit);
+        return true;
+    }
+    if (kind == "import" && fields.size() == 3) {
+        record.type = EditJournal::Record::ImportFile;
+        record.hash = fields.at(1);
+        record.fileName = decodeField(fields.at(2));
+        return true;
+    }
+    if (kind == "delete" && fields.size() == 2) {
+        record.type = EditJournal::Record::DeleteFile;
+        record.fileName = decodeField(fields.at(1));
+        return true;
+    }
+    return false;
+}
+
+EditJournal::EditJournal(QString const& dirPath, QObject* parent) :
+    QObject(parent),
+    dirPath(dirPath)
+{
+    commitTimer.setSingleShot(true);
+    commitTimer.setInterval(defaultCommitInterval);
+    connect(&commitTimer, SIGNAL(timeout()), this, SLOT(commit()));
+}
+
+EditJournal::~EditJournal() {
+    commit();
+}
+
+/* Begin a new journal, previous records and blobs are dropped
+ * @param targetPath: save file the session will be written to
+ * @param basePath: save file the records will be replayed onto
+ */
+void EditJournal::start(const QString &targetPath, const QString &basePath) {
+    commitTimer.stop();
+    pending.clear();
+    pendingRecords = 0;
+    journalFile.close();
+
+    QDir(blobDirPath()).removeRecursively();
+    QDir(dirPath).mkpath(blobDirName);
+    if (QFileInfo(basePath) != QFileInfo(checkpointPath()))
+        QFile::remove(checkpointPath());
+    blobBytes = 0;
+    compactionRequested = false;
+
+    // header is written atomically, a crash leaves either the old or the new journal
+    QSaveFile header(journalFilePath());
+    if (!header.open(QFile::WriteOnly))
+        throw std::runtime_error(("Could not create edit journal in \"" + dirPath + "\"").toStdString());
+    header.write(journalMagic + '\n');
+    header.write(makeLine("target\t" + encodeField(targetPath)));
+    header.write(makeLine("base\t" + encodeField(basePath)));
+    if (!header.commit())
+        throw std::runtime_error(("Could not create edit journal in \"" + dirPath + "\"").toStdString());
+    resume();
+}
+
+// Continue appending to the journal present on disk (after recovery)
+void EditJournal::resume() {
+    journalFile.close();
+    journalFile.setFileName(journalFilePath());
+    // unbuffered, so a failed write can't leave bytes behind to be flushed with a later commit
+    if (!journalFile.open(QFile::WriteOnly | QFile::Append | QFile::Unbuffered))
+        throw std::runtime_error(("Could not open edit journal \"" + journalFilePath() + "\"").toStdString());
+    blobBytes = 0;
+    for (QFileInfo const& blob: QDir(blobDirPath()).entryInfoList(QDir::Files))
+        blobBytes += blob.size();
+}
+
+// Drop the journal, used after the session was saved or closed cleanly
+void EditJournal::discard() {
+    commitTimer.stop();
+    pending.clear();
+    pendingRecords = 0;
+    journalFile.close();
+    QDir(dirPath).removeRecursively();
+    blobBytes = 0;
+}
+
+bool EditJournal::isActive() const {
+    return journalFile.isOpen();
+}
+
+/* Read the journal left on disk
+ * Reading stops at the first torn or corrupted record.
+ * @returns bool: false when there is no journal to recover
+ */
+bool EditJournal::load(Contents& contents) const {
+    QFile file(journalFilePath());
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    if (file.readLine().trimmed() != journalMagic)
+        return false;
+    contents = Contents();
+    while (!file.atEnd()) {
+        QByteArray payload;
+        if (!parseLine(file.readLine(), payload))
+            break;
+        if (payload.startsWith("target\t")) {
+            contents.targetPath = decodeField(payload.mid(7));
+        } else if (payload.startsWith("base\t")) {
+            contents.basePath = decodeField(payload.mid(5));
+        } else {
+            Record record;
+            if (!parseRecord(payload, record))
+                break;
+            contents.records.push_back(record);
+        }
+    }
+    return !contents.basePath.isEmpty();
+}
+
+void EditJournal::recordEdit(const GameSession::Edit &edit) {
+    switch (edit.type) {
+    case GameSession::Edit::SetMoney:
+        append("money\t" + QByteArray::number(edit.amount));
+        break;
+    case GameSession::Edit::AddSubmarine:
+        append("add\t" + subTypeToken(edit.subType) + '\t' + encodeField(edit.name));
+        break;
+    case GameSession::Edit::RemoveSubmarine:
+        append("remove\t" + subTypeToken(edit.subType) + '\t' + encodeField(edit.name));
+        break;
+    case GameSession::Edit::EditLocations:
+        append(locationEditPayload(edit.locations));
+        break;
+    }
+}
+
+/* Store a copy of an imported file in the blob store and record the import
+ * @param fileName: name of the file in the session
+ * @param hash: SHA-1 of content, hex encoded
+ * @param content: file contents
+ */
+void EditJournal::recordImport(const QString &fileName, const QByteArray &hash, const QByteArray &content) {
+    recordImports({Import{fileName, hash, content}});
+}
+
+/* Record files added to the session
+ * @throws std::runtime_error: if a blob could not be stored, nothing is recorded then
+ */
+void EditJournal::recordImports(const QVector<Import> &imports) {
+    if (!isActive())
+        return;
+    storeBlobs(imports);
+    for (Import const& import: imports) {
+        append("import\t" + import.hash + '\t' + encodeField(import.fileName));
+    }
+}
+
+/* Store contents of files about to be imported, without recording the imports
+ * Blobs of new contents are written concurrently (BatchIO) to temporary
+ * files and renamed in place, identical content is stored once.
+ * @throws std::runtime_error: if a blob could not be stored
+ */
+void EditJournal::storeBlobs(const QVector<Import> &imports) {
+    if (!isActive())
+        return;
+
+    std::vector<BatchIO::WriteRequest> writes;
+    QSet<QByteArray> queued;
+    for (Import const& import: imports) {
+        if (queued.contains(import.hash) || QFile::exists(blobPath(import.hash)))
+            continue;
+        queued.insert(import.hash);
+        writes.push_back({blobPath(import.hash) + blobTempSuffix, import.content.constData(),
+                          static_cast<size_t>(import.content.size())});
+    }
+    try {
+        BatchIO::writeFiles(writes);
+    } catch (std::runtime_error const& e) {
+        for (BatchIO::WriteRequest const& write: writes)
+            QFile::remove(write.path);
+        throw std::runtime_error(std::string("Could not store imported files in edit journal: ") + e.what());
+    }
+    for (BatchIO::WriteRequest const& write: writes) {
+        QString blob = write.path;
+        blob.chop(blobTempSuffix.size());
+        if (!QFile::rename(write.path, blob)) {
+            QFile::remove(write.path);
+            throw std::runtime_error(("Could not store \"" + blob + "\" in edit journal").toStdString());
+        }
+        blobBytes += static_cast<qint64>(write.size);
+    }
+}
+
+void EditJournal::recordDelete(const QString &fileName) {
+    append("delete\t" + encodeField(fileName));
+}
+
+QString EditJournal::blobPath(const QByteArray &hash) const {
+    return blobDirPath() + QDir::separator() + QString::fromLatin1(hash);
+}
+
+// where the session is checkpointed when the journal grows too large
+QString EditJournal::checkpointPath() const {
+    return dirPath + QDir::separator() + checkpointFileName;
+}
+
+// @returns qint64: bytes used by the journal and its blob store
+qint64 EditJournal::size() const {
+    return journalFile.size() + pending.size() + blobBytes;
+}
+
+void EditJournal::setSizeThreshold(qint64 bytes) {
+    sizeThreshold = bytes;
+}
+
+void EditJournal::setCommitInterval(int msec) {
+    commitTimer.setInterval(msec);
+}
+
+// Checkpoint could not be written, compactionNeeded is emitted again on a later commit
+void EditJournal::compactionFailed() {
+    compactionRequested = false;
+}
+
+// Write all pending records to disk with a single sync
+void EditJournal::commit() {
+    commitTimer.stop();
+    if (pending.isEmpty() || !journalFile.isOpen())
+        return;
+    // records stay pending until they are durable, a torn write is cut off again
+    qint64 committedSize = journalFile.size();
+    if (journalFile.write(pending) != pending.size() || !syncToDisk()) {
+        QString error = journalFile.errorString();
+        if (!truncateTo(committedSize)) {
+            // later records would follow the torn ones and be lost on recovery, stop journaling
+            journalFile.close();
+            error += " (journaling stopped)";
+        }
+        emit commitFailed(QString("Could not write edit journal \"%1\": %2")
+                          .arg(journalFilePath(), error));
+        return;
+    }
+    pending.clear();
+    pendingRecords = 0;
+    if (!compactionRequested && size() > sizeThreshold) {
+        compactionRequested = true;
+        emit compactionNeeded();
+    }
+}
+
+/* Cut off a partially written group commit
+ * The file is reopened when it can't be truncated through the open handle.
+ * @returns bool: false if the journal still ends with the torn records
+ */
+bool EditJournal::truncateTo(qint64 committedSize) {
+    if (journalFile.resize(committedSize))
+        return true;
+    journalFile.close();
+    return QFile::resize(journalFilePath(), committedSize) &&
+            journalFile.open(QFile::WriteOnly | QFile::Append | QFile::Unbuffered);
+}
+
+// Queue a record for the next group commit
+void EditJournal::append(const QByteArray &payload) {
+    if (!isActive())
+        return;
+    pending += makeLine(payload);
+    pendingRecords++;
+    if (pendingRecords >= groupCommitRecords)
+        commit();
+    else if (!commitTimer.isActive())
+        commitTimer.start();
+}
+
+// @returns bool: false if the data could not be synced
+bool EditJournal::syncToDisk() {
+#ifdef Q_OS_WIN
+    return _commit(journalFile.handle()) == 0;
+#else
+    return fsync(journalFile.handle()) == 0;
+#endif
+}
+
+QString EditJournal::journalFilePath() const {
+    return dirPath + QDir::separator() + journalFileName;
+}
+
+QString EditJournal::blobDirPath() const {
+    return dirPath + QDir::separator() + blobDirName;
+}
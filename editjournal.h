@@ -0,0 +1,97 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include <gamesession.h>
+
+/* Append-only journal of edits made to an opened save
+ * Records are buffered and committed to disk in groups, a crashed session
+ * is recovered by replaying the journal onto its base save file.
+ * Imported files are kept in a blob store keyed by their content hash.
+ */
+class EditJournal : public QObject
+{
+    Q_OBJECT
+public:
+    struct Record {
+        enum Type {
+            SessionEdit,  // edit of gamesession.xml
+            ImportFile,   // file added to the session
+            DeleteFile    // file removed from the session
+        };
+        Type type;
+        GameSession::Edit edit;
+        QString fileName;
+        QByteArray hash;
+    };
+
+    // file added to the session, see recordImports
+    struct Import {
+        QString fileName;
+        QByteArray hash;
+        QByteArray content;
+    };
+
+    // journal read back from disk
+    struct Contents {
+        QString targetPath; // save file the session is written to
+        QString basePath;   // save file the records are replayed onto
+        QVector<Record> records;
+    };
+
+    explicit EditJournal(QString const& dirPath, QObject* parent = nullptr);
+    ~EditJournal() override;
+
+    void start(QString const& targetPath, QString const& basePath);
+    void resume();
+    void discard();
+    bool isActive() const;
+    bool load(Contents& contents) const;
+
+    void recordEdit(GameSession::Edit const& edit);
+    void recordImport(QString const& fileName, QByteArray const& hash, QByteArray const& content);
+    void recordImports(QVector<Import> const& imports);
+    void storeBlobs(QVector<Import> const& imports);
+    void recordDelete(QString const& fileName);
+
+    QString blobPath(QByteArray const& hash) const;
+    QString checkpointPath() const;
+    qint64 size() const;
+    void setSizeThreshold(qint64 bytes);
+    void setCommitInterval(int msec);
+    void compactionFailed();
+
+public slots:
+    void commit();
+
+signals:
+    // journal grew past the size threshold, session should be checkpointed
+    void compactionNeeded();
+    // pending records could not be written, they are retried on the next commit
+    // unless the torn write could not be cut off, then the journal is closed
+    void commitFailed(QString const& message);
+
+private:
+    void append(QByteArray const& payload);
+    bool syncToDisk();
+    bool truncateTo(qint64 committedSize);
+    QString journalFilePath() const;
+    QString blobDirPath() const;
+
+    QString dirPath;
+    QFile journalFile;
+    QByteArray pending; // records waiting for the next group commit
+    int pendingRecords = 0;
+    QTimer commitTimer;
+    qint64 blobBytes = 0;
+    qint64 sizeThreshold = 32 * 1024 * 1024; // journal + blob store
+    bool compactionRequested = false;
+};
+
+#endif // EDITJOURNAL_H
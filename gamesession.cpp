@@ -2,12 +2,17 @@
 
 #include <QDebug>
 #include <QFile>
+#include <QSet>
 
 #include <stdexcept>
 
+#include <memoryaccounting.h>
+
 static const QString availableSubsTagName = "AvailableSubs";
 static const QString ownedSubsTagName = "ownedsubmarines";
 static const QString gameSessionTagName = "Gamesession";
+// rough size of a QDomDocument relative to the XML it was parsed from
+static const size_t domExpansion = 8;
 
 // from
 // https://github.com/Regalis11/Barotrauma/blob/4978af3d602730de2e2742af8541ef43b227efe9/Barotrauma/BarotraumaShared/SharedSource/GameSession/GameModes/GameModePreset.cs#L11
@@ -21,6 +26,22 @@ static const QStringList gameModes{
     "DevSandbox"
 };
 
+GameSession::Edit GameSession::Edit::setMoney(qint64 amount) {
+    return Edit{SetMoney, QString(), AvailableSubmarine, amount, LocationIndex::Edit()};
+}
+
+GameSession::Edit GameSession::Edit::addSubmarine(const QString &name, SubmarineType type) {
+    return Edit{AddSubmarine, name, type, 0, LocationIndex::Edit()};
+}
+
+GameSession::Edit GameSession::Edit::removeSubmarine(const QString &name, SubmarineType type) {
+    return Edit{RemoveSubmarine, name, type, 0, LocationIndex::Edit()};
+}
+
+GameSession::Edit GameSession::Edit::editLocations(const LocationIndex::Edit &edit) {
+    return Edit{EditLocations, QString(), AvailableSubmarine, 0, edit};
+}
+
 GameSession::GameSession(QString const& xmlPath)
 {
     fromXML(xmlPath);
@@ -32,7 +53,8 @@ void GameSession::dumpXML() {
 }
 
 void GameSession::dumpXML(const QString &xmlPath) {
-    QByteArray out = xmlTree.toByteArray(2);
+    MemoryAccounting::Buffer textCharge;
+    QByteArray out = serialize(xmlTree, baseXml.size(), &textCharge);
     QFile file(xmlPath);
     file.open(QFile::WriteOnly | QFile::Truncate);
     file.write(out);
@@ -43,7 +65,79 @@ bool GameSession::fromXML(const QString &xmlPath) {
     this->xmlPath = xmlPath;
     QFile file(xmlPath);
     file.open(QFile::ReadOnly);
-    return this->xmlTree.setContent(file.readAll());
+    return setContent(file.readAll());
+}
+
+/* Load game session from XML data, edit log starts over
+ * The tree stays charged to the memory budget for as long as the session holds it.
+ * @throws std::runtime_error: when the estimated tree size exceeds the memory budget
+ */
+bool GameSession::setContent(const QByteArray &xml) {
+    MemoryAccounting::StageScope stage(MemoryAccounting::ParseXML);
+    // the budget is checked against an estimate, the heap hook reports the real size
+    treeCharge.resize(static_cast<size_t>(xml.size()) * domExpansion);
+    baseXml = xml;
+    editLog.clear();
+    generation++;
+    locationIndex.clear();
+    return this->xmlTree.setContent(xml);
+}
+
+/* Write XML tree with 2 space indentation
+ * @param sizeHint: expected size of the XML, checked against the memory budget
+ * @param charge: holds the size of the returned XML, release it together with the XML
+ */
+QByteArray GameSession::serialize(const QDomDocument &tree, int sizeHint, MemoryAccounting::Buffer* charge) {
+    MemoryAccounting::StageScope stage(MemoryAccounting::SerializeXML);
+    // UTF-16 text is built first and dropped after the conversion to UTF-8
+    MemoryAccounting::Buffer utf16Charge(static_cast<size_t>(sizeHint) * 2);
+    charge->resize(static_cast<size_t>(sizeHint));
+    QByteArray xml = tree.toByteArray(2);
+    charge->resize(static_cast<size_t>(xml.size()));
+    MemoryAccounting::copied(static_cast<size_t>(xml.size()));
+    return xml;
+}
+
+/* Take a snapshot of the current session state
+ * Cost is proportional to the number of edits made since the session
+ * was loaded or last rebased, the XML tree is not copied.
+ */
+GameSession::Snapshot GameSession::snapshot() const {
+    Snapshot result;
+    result.baseXml = baseXml;
+    result.edits = editLog;
+    result.generation = generation;
+    return result;
+}
+
+/* Make XML written from a snapshot the new base of the session
+ * Edits made after the snapshot was taken are kept on top of it.
+ * @param saved: snapshot that was written
+ * @param savedXML: result of saved.toXML()
+ */
+void GameSession::rebase(const Snapshot &saved, const QByteArray &savedXML) {
+    if (saved.generation != generation || saved.edits.size() > editLog.size())
+        return; // session was reloaded in the meantime
+    baseXml = savedXML;
+    editLog.remove(0, saved.edits.size());
+}
+
+/* Serialize the snapshot
+ * The shared base is parsed into a private tree, so this can run on any thread.
+ * @param charge: holds the size of the returned XML unless it is the unchanged base
+ * @throws std::runtime_error: when the base XML can't be parsed
+ */
+QByteArray GameSession::Snapshot::toXML(MemoryAccounting::Buffer* charge) const {
+    if (edits.isEmpty())
+        return baseXml;
+    GameSession session;
+    if (!session.setContent(baseXml))
+        throw std::runtime_error("Could not parse gamesession.xml snapshot");
+    for (Edit const& edit: edits) {
+        session.apply(edit);
+    }
+    MemoryAccounting::Buffer textCharge;
+    return serialize(session.xmlTree, baseXml.size(), charge ? charge : &textCharge);
 }
 
 /* Add submarine to game session
@@ -69,9 +163,48 @@ bool GameSession::addSubmarine(const QString &name, SubmarineType type) {
     QDomNode subNode = xmlTree.createElement("sub");
     nodeList.at(0).appendChild(subNode);
     subNode.toElement().setAttribute("name", name);
+    editLog.push_back(Edit::addSubmarine(name, type));
     return true;
 }
 
+/* Add several submarines in one update
+ * The submarine list is looked up once for the whole batch.
+ * @returns QStringList: names that were added, ones already in the list are skipped
+ * @throws std::runtime_error: same as addSubmarine
+ */
+QStringList GameSession::addSubmarines(const QStringList &names, SubmarineType type) {
+    QDomNodeList nodeList;
+    if (type == AvailableSubmarine)
+        nodeList = xmlTree.elementsByTagName(availableSubsTagName);
+    else
+        nodeList = xmlTree.elementsByTagName(ownedSubsTagName);
+    if (nodeList.length() > 1) {
+        throw std::runtime_error("Could not add submarines - gamesession.xml "
+                                 "contains too many <AvailableSubs> or <OwnedSubs tags");
+    }
+    if (nodeList.isEmpty()) {
+        throw std::runtime_error("Could not add submarines - gamesession.xml "
+                                 "doesn't have an <AvailableSubs> tag");
+    }
+    QSet<QString> present;
+    for (QString const& name: submarinesList(type))
+        present.insert(name);
+
+    QStringList added;
+    QDomNode listNode = nodeList.at(0);
+    for (QString const& name: names) {
+        if (present.contains(name))
+            continue;
+        QDomElement subNode = xmlTree.createElement("sub");
+        subNode.setAttribute("name", name);
+        listNode.appendChild(subNode);
+        present.insert(name);
+        editLog.push_back(Edit::addSubmarine(name, type));
+        added.push_back(name);
+    }
+    return added;
+}
+
 /*
  * @returns: true when submarine was removed successfully
  */
@@ -89,6 +222,7 @@ bool GameSession::removeSubmarine(const QString &name, SubmarineType type) {
         QDomElement subElem = subNode.toElement();
         if (subElem.attribute("name") == name) {
             nodeList.at(0).removeChild(subNode);
+            editLog.push_back(Edit::removeSubmarine(name, type));
             return true;
         }
     }
@@ -155,6 +289,23 @@ QStringList GameSession::submarinesList(SubmarineType type) const{
     return names;
 }
 
+/* Apply a single edit to the session
+ * @returns: the result of the underlying operation
+ */
+bool GameSession::apply(Edit const& edit) {
+    switch (edit.type) {
+    case Edit::SetMoney:
+        return setMoney(edit.amount);
+    case Edit::AddSubmarine:
+        return addSubmarine(edit.name, edit.subType);
+    case Edit::RemoveSubmarine:
+        return removeSubmarine(edit.name, edit.subType);
+    case Edit::EditLocations:
+        return editLocations({edit.locations}) > 0;
+    }
+    return false;
+}
+
 qint64 GameSession::getMoney() {
     for (QString const& mode: gameModes) {
         QDomNodeList nodeList = xmlTree.elementsByTagName(mode);
@@ -171,8 +322,43 @@ bool GameSession::setMoney(qint64 amount) {
         if (nodeList.size() != 0) {
             QDomElement elem = nodeList.at(0).toElement();
             elem.setAttribute("money", amount);
+            editLog.push_back(Edit::setMoney(amount));
             return true;
         }
     }
     return false;
 }
+
+// @returns QVector<LocationIndex::Location>: campaign map locations matched by filter
+QVector<LocationIndex::Location> GameSession::locations(const LocationIndex::Filter &filter) {
+    if (!locationIndex.isBuilt())
+        locationIndex.build(xmlTree);
+    QVector<LocationIndex::Location> result;
+    for (int index: locationIndex.select(filter)) {
+        result.push_back(locationIndex.at(index));
+    }
+    return result;
+}
+
+/* Edit campaign map locations in bulk
+ * All edits are applied in one pass over the matched locations,
+ * only edits that changed a location are logged.
+ * @param appliedEdits: set to the number of edits that changed a location, may be null
+ * @returns int: number of locations changed
+ */
+int GameSession::editLocations(const QVector<LocationIndex::Edit> &edits, int* appliedEdits) {
+    if (!locationIndex.isBuilt())
+        locationIndex.build(xmlTree);
+    QVector<bool> changedBy;
+    int changed = locationIndex.apply(edits, &changedBy);
+    int applied = 0;
+    for (int i = 0; i < edits.size(); i++) {
+        if (changedBy.at(i)) {
+            editLog.push_back(Edit::editLocations(edits.at(i)));
+            applied++;
+        }
+    }
+    if (appliedEdits)
+        *appliedEdits = applied;
+    return changed;
+}
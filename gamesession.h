@@ -1,8 +1,13 @@
 #ifndef GAMESESSION_H
 #define GAMESESSION_H
 
+#include <QByteArray>
 #include <QString>
 #include <QDomDocument>
+#include <QVector>
+
+#include <locationindex.h>
+#include <memoryaccounting.h>
 
 class GameSession
 {
@@ -11,6 +16,42 @@ public:
         AvailableSubmarine,
         OwnedSubmarine
     };
+    // Single edit of the session, journaled so it can be replayed later
+    struct Edit {
+        enum Type {
+            SetMoney,
+            AddSubmarine,
+            RemoveSubmarine,
+            EditLocations
+        };
+        Type type = SetMoney;
+        QString name;
+        SubmarineType subType = AvailableSubmarine;
+        qint64 amount = 0;
+        LocationIndex::Edit locations; // EditLocations only
+
+        static Edit setMoney(qint64 amount);
+        static Edit addSubmarine(QString const& name, SubmarineType type);
+        static Edit removeSubmarine(QString const& name, SubmarineType type);
+        static Edit editLocations(LocationIndex::Edit const& edit);
+    };
+
+    /* Immutable state of the session at some point in time
+     * Shares the XML read from disk with the session and only copies the
+     * edits made since, so taking it is cheap. Safe to use from other threads.
+     */
+    class Snapshot
+    {
+    public:
+        QByteArray toXML(MemoryAccounting::Buffer* charge = nullptr) const;
+        int editCount() const { return edits.size(); }
+    private:
+        friend class GameSession;
+        QByteArray baseXml;
+        QVector<Edit> edits;
+        quint64 generation = 0;
+    };
+
     GameSession() = default;
     GameSession(QString const& xmlPath);
 
@@ -19,24 +60,42 @@ public:
     void dumpXML();
     void dumpXML(QString const& xmlPath);
     bool fromXML(QString const& xmlPath);
+    bool setContent(QByteArray const& xml);
 
     // submarine management
 
     bool addSubmarine(QString const& name, SubmarineType type);
+    QStringList addSubmarines(QStringList const& names, SubmarineType type);
     bool removeSubmarine(QString const& name, SubmarineType type);
     bool containsSubmarine(QString const& name);
     bool containsSubmarine(QString const& name, SubmarineType type);
     QString currentSubmarine();
     QStringList submarinesList(SubmarineType type) const;
 
+    bool apply(Edit const& edit);
+    Snapshot snapshot() const;
+    void rebase(Snapshot const& saved, QByteArray const& savedXML);
+
     // general info
 
     qint64 getMoney();
     bool setMoney(qint64 amount);
 
+    // campaign map
+
+    QVector<LocationIndex::Location> locations(LocationIndex::Filter const& filter);
+    int editLocations(QVector<LocationIndex::Edit> const& edits, int* appliedEdits = nullptr);
+
 private:
+    static QByteArray serialize(QDomDocument const& tree, int sizeHint, MemoryAccounting::Buffer* charge);
+
     QString xmlPath;
     QDomDocument xmlTree;
+    MemoryAccounting::Buffer treeCharge; // estimated size of xmlTree
+    LocationIndex locationIndex; // built on first use
+    QByteArray baseXml;    // XML the session was loaded from
+    QVector<Edit> editLog; // edits made on top of baseXml
+    quint64 generation = 0; // changes whenever the session is reloaded
 };
 
 #endif // GAMESESSION_H
@@ -7,52 +7,175 @@
 #include <QLabel>
 #include <QListWidget>
 #include <QMessageBox>
+#include <QPixmap>
 #include <QPushButton>
 #include <QStandardPaths>
 #include <QTabWidget>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <stdexcept>
 
+#include <memoryaccounting.h>
 #include <saveutil.h>
 
-const QString GameSessionEditor::workspacePath = "workspace";
 static const QString subExt = ".sub";
+static const QString gameSessionFileName = "gamesession.xml";
+static const QSize thumbnailSize(96, 54);
 
-GameSessionEditor::GameSessionEditor(QWidget *parent) :
+GameSessionEditor::GameSessionEditor(QString const& journalDir, QWidget *parent) :
     QWidget(parent),
-    ui(new Ui::GameSessionEditor)
+    ui(new Ui::GameSessionEditor),
+    journalDir(journalDir),
+    journal(new EditJournal(journalDir, this)),
+    thumbnails(new ThumbnailCache(thumbnailSize, this)),
+    saveWatcher(new QFutureWatcher<SaveResult>(this)),
+    importWatcher(new QFutureWatcher<SubmarineImport::Result>(this))
 {
     ui->setupUi(this);
+    QPixmap placeholder(thumbnailSize);
+    placeholder.fill(QColor(40, 40, 40));
+    placeholderIcon = QIcon(placeholder);
+    ui->availableSubsList->setIconSize(thumbnailSize);
+    ui->ownedSubsList->setIconSize(thumbnailSize);
+    connect(thumbnails, SIGNAL(thumbnailReady(QString,QImage)), this, SLOT(showThumbnail(QString,QImage)));
     connect(this, SIGNAL(sessionLoaded(bool)), ui->subTab, SLOT(setEnabled(bool)));
     connect(this, SIGNAL(sessionLoaded(bool)), ui->generalTab, SLOT(setEnabled(bool)));
+    connect(journal, SIGNAL(compactionNeeded()), this, SLOT(compactJournal()));
+    connect(journal, SIGNAL(commitFailed(QString)), this, SLOT(displayError(QString)));
+    connect(saveWatcher, SIGNAL(finished()), this, SLOT(saveFinished()));
+    connect(importWatcher, SIGNAL(finished()), this, SLOT(importFinished()));
 }
 
-// Populate forms with extracted data
-// Data should be located in directory dir
-void GameSessionEditor::processSessionFiles(QString const& dir) {
-    QDir sessionDir(dir);
-    QStringList subNames;
-    bool gameSessionFound = false;
-    for (QString const& str: sessionDir.entryList(QDir::Files)) {
-         QFileInfo fileInfo(dir + QDir::separator() + str);
-         if (fileInfo.fileName() == "gamesession.xml") {
-             gameSessionFound = true;
-             bool success = gameSession.fromXML(fileInfo.absoluteFilePath());
-             if (!success)
-                 qDebug() << "Error processing gamesession.xml";
-         }
-    }
-    if (!gameSessionFound) {
-        displayError("Could not find gamesession.xml in workspace");
+// closing the editor drops unsaved edits, the journal is only kept after a crash
+GameSessionEditor::~GameSessionEditor() {
+    // let a running save complete, without reporting it to an editor that is going away
+    saveWatcher->disconnect(this);
+    saveWatcher->waitForFinished();
+    importWatcher->disconnect(this);
+    importWatcher->cancel();
+    importWatcher->waitForFinished();
+    journal->discard();
+    delete ui;
+}
+
+QString GameSessionEditor::filePath() const {
+    return openedFilePath;
+}
+
+QString GameSessionEditor::journalDirectory() const {
+    return journalDir;
+}
+
+bool GameSessionEditor::hasSession() const {
+    return !openedFilePath.isEmpty();
+}
+
+bool GameSessionEditor::hasUnsavedChanges() const {
+    return hasSession() && changeCount != savedChangeCount;
+}
+
+/* Look up submarines of the session
+ * @returns QMap<QString, PayloadRef>: payload of each submarine by name,
+ * null for submarines that are not stored in the save (e.g. vanilla ones)
+ */
+QMap<QString, PayloadRef> GameSessionEditor::submarinePayloads(const QStringList &names) const {
+    QMap<QString, PayloadRef> submarines;
+    for (QString const& name: names) {
+        submarines.insert(name, files.value(name + subExt));
     }
+    return submarines;
+}
+
+/* Make submarines available in the session
+ * Payloads are shared with their source, nothing is copied.
+ * @returns int: number of submarines added, ones already in the session are skipped
+ */
+int GameSessionEditor::importSubmarines(const QMap<QString, PayloadRef> &submarines) {
+    int added = 0;
+    try {
+        for (auto it = submarines.constBegin(); it != submarines.constEnd(); ++it) {
+            QString const& name = it.key();
+            if (files.contains(name + subExt) || gameSession.containsSubmarine(name, GameSession::AvailableSubmarine))
+                continue;
+            if (it.value())
+                addFile(name + subExt, it.value());
+            addSubItem(ui->availableSubsList, name);
+            applyEdit(GameSession::Edit::addSubmarine(name, GameSession::AvailableSubmarine));
+            added++;
+        }
+    } catch (std::runtime_error const& e) {
+        displayError(e.what());
+    }
+    return added;
+}
+
+/* Load game session and the files stored with it from a save archive
+ * @throws std::runtime_error: when the save is corrupted or has no gamesession.xml
+ */
+void GameSessionEditor::loadSave(QString const& filePath) {
+    QMap<QString, PayloadRef> loadedFiles;
+    QByteArray sessionXML;
+    bool gameSessionFound = false;
+    PayloadStore& store = PayloadStore::shared();
+    SaveUtil::readArchive(filePath, [&](QString const& fileName, const char* content, size_t size) {
+        if (fileName == gameSessionFileName) {
+            gameSessionFound = true;
+            sessionXML = QByteArray(content, static_cast<int>(size));
+        } else {
+            loadedFiles.insert(fileName, store.intern(content, size));
+        }
+    });
+    if (!gameSessionFound)
+        throw std::runtime_error(("Could not find gamesession.xml in \"" + filePath + "\"").toStdString());
+    if (!gameSession.setContent(sessionXML))
+        qDebug() << "Error processing gamesession.xml";
+    files = loadedFiles;
+}
+
+// Fill forms with data from the loaded game session
+void GameSessionEditor::populateForms() {
     // list available submarines
-    ui->availableSubsList->addItems(gameSession.submarinesList(GameSession::AvailableSubmarine));
-    ui->ownedSubsList->addItems(gameSession.submarinesList(GameSession::OwnedSubmarine));
+    for (QString const& name: gameSession.submarinesList(GameSession::AvailableSubmarine))
+        addSubItem(ui->availableSubsList, name);
+    for (QString const& name: gameSession.submarinesList(GameSession::OwnedSubmarine))
+        addSubItem(ui->ownedSubsList, name);
 
     // general info updates
     ui->moneyEdit->setText(QString::number(gameSession.getMoney()));
 }
 
+// Add submarine to a list widget, its thumbnail (by content hash) replaces the placeholder icon when ready
+void GameSessionEditor::addSubItem(QListWidget* list, const QString &name) {
+    PayloadRef payload = files.value(name + subExt);
+    if (!payload) {
+        list->addItem(new QListWidgetItem(placeholderIcon, name));
+        return;
+    }
+    QString key = QString::fromLatin1(payload->hash);
+    auto icon = subIcons.constFind(key);
+    if (icon != subIcons.constEnd()) {
+        list->addItem(new QListWidgetItem(*icon, name));
+        return;
+    }
+    list->addItem(new QListWidgetItem(placeholderIcon, name));
+    thumbnails->request(key, payload->data);
+}
+
+void GameSessionEditor::showThumbnail(const QString &key, const QImage &image) {
+    QIcon icon(QPixmap::fromImage(image));
+    subIcons.insert(key, icon);
+    QByteArray hash = key.toLatin1();
+    for (QListWidget* list: {ui->availableSubsList, ui->ownedSubsList}) {
+        for (int i = 0; i < list->count(); i++) {
+            QListWidgetItem* item = list->item(i);
+            PayloadRef payload = files.value(item->text() + subExt);
+            if (payload && payload->hash == hash)
+                item->setIcon(icon);
+        }
+    }
+}
+
 void GameSessionEditor::enableAllChildWidgets() {
     for (QWidget* wp: findChildren<QWidget*>()) {
         wp->setEnabled(true);
@@ -65,12 +188,55 @@ void GameSessionEditor::displayError(QString const& message) {
     em.exec();
 }
 
-/* Remove file present in workspace directory
+// Store file with the session and record it in the journal
+void GameSessionEditor::addFile(const QString &fileName, const PayloadRef &payload) {
+    journal->recordImport(fileName, payload->hash, payload->data);
+    changeCount++;
+    files.insert(fileName, payload);
+}
+
+/* Remove file stored with the session
+ * A save being written keeps its own reference to the payload.
  * @param fileName: Name of the file to remove
- * @returns bool: true on success
  */
-bool GameSessionEditor::removeFromWorkspace(const QString &fileName) {
-    return QFile::remove(workspacePath + QDir::separator() + fileName);
+void GameSessionEditor::removeFile(const QString &fileName) {
+    journal->recordDelete(fileName);
+    changeCount++;
+    files.remove(fileName);
+}
+
+/* Apply edit to the game session and record it in the journal
+ * @returns bool: true if the session was changed
+ */
+bool GameSessionEditor::applyEdit(const GameSession::Edit &edit) {
+    bool success = gameSession.apply(edit);
+    if (success) {
+        journal->recordEdit(edit);
+        changeCount++;
+    }
+    return success;
+}
+
+// Replay journal records onto a freshly loaded session
+void GameSessionEditor::replayJournal(const EditJournal::Contents &contents) {
+    for (EditJournal::Record const& record: contents.records) {
+        switch (record.type) {
+        case EditJournal::Record::SessionEdit:
+            gameSession.apply(record.edit);
+            break;
+        case EditJournal::Record::ImportFile: {
+            QFile blob(journal->blobPath(record.hash));
+            if (!blob.open(QFile::ReadOnly))
+                throw std::runtime_error(("Could not restore \"" + record.fileName + "\" from edit journal").toStdString());
+            files.insert(record.fileName, PayloadStore::shared().intern(blob.readAll()));
+            break;
+        }
+        case EditJournal::Record::DeleteFile:
+            files.remove(record.fileName);
+            break;
+        }
+    }
+    changeCount += static_cast<quint64>(contents.records.size());
 }
 
 void GameSessionEditor::on_addSubButton_clicked() {
@@ -86,26 +252,130 @@ void GameSessionEditor::on_addSubButton_clicked() {
     QFileInfo subFileInfo(subFile);
     QString subFileName = subFileInfo.fileName();
     QString subFileExt = subFileInfo.suffix();
-    QString dest = workspacePath + QDir::separator() + subFileName;
     QListWidget* availableSubsList = ui->availableSubsList;
-    QString subName(std::move(subFileName));
+    QString subName(subFileName);
     subName.chop(subFileExt.size()+1); // remove extension and dot
-    if (QFile::exists(dest) || !availableSubsList->findItems(subName, Qt::MatchExactly).empty()) {
+    if (files.contains(subFileName) || !availableSubsList->findItems(subName, Qt::MatchExactly).empty()) {
         displayError(tr("Submarine with this name already exists in current game session"));
         return;
     }
-    // copy submarine to workspace
-    subFile.copy(dest);
+    if (!subFile.open(QFile::ReadOnly)) {
+        displayError(tr("Could not read submarine file \"%1\"").arg(subPath));
+        return;
+    }
     // add sub to available list
-    availableSubsList->addItem(subName);
-    // add sub to XML tree
     try {
-        gameSession.addSubmarine(subName, GameSession::AvailableSubmarine);
+        // identical submarines of other opened saves are shared
+        addFile(subFileName, PayloadStore::shared().intern(subFile.readAll()));
+        addSubItem(availableSubsList, subName);
+        // add sub to XML tree
+        applyEdit(GameSession::Edit::addSubmarine(subName, GameSession::AvailableSubmarine));
     } catch (std::runtime_error const& e) {
         displayError(e.what());
     }
 }
 
+/* Import every submarine file of a folder
+ * Files are validated and hashed in the background, ones with contents already
+ * in the save are skipped. New submarines are added to the session in one update.
+ */
+void GameSessionEditor::on_importSubsButton_clicked() {
+    QString dirPath = QFileDialog::getExistingDirectory(this, tr("Import submarines from folder"));
+    if (dirPath.isEmpty())
+        return;
+
+    QSet<QByteArray> knownHashes;
+    for (PayloadRef const& payload: files)
+        knownHashes.insert(payload->hash);
+    importDirPath = dirPath;
+    importPending = true;
+    ui->importSubsButton->setEnabled(false);
+    importWatcher->setFuture(SubmarineImport::loadDirectory(dirPath, knownHashes));
+}
+
+// Drop a running folder import, its results are not added to any session
+void GameSessionEditor::cancelImport() {
+    if (!importPending)
+        return;
+    importPending = false;
+    importWatcher->cancel();
+    importWatcher->waitForFinished();
+    ui->importSubsButton->setEnabled(true);
+}
+
+// Add the submarines loaded by on_importSubsButton_clicked
+void GameSessionEditor::importFinished() {
+    // dropped when another save was opened meanwhile
+    if (!importPending)
+        return;
+    importPending = false;
+    ui->importSubsButton->setEnabled(true);
+    QList<SubmarineImport::Result> results = importWatcher->future().results();
+    if (results.isEmpty()) {
+        displayError(tr("No submarine files found in \"%1\"").arg(importDirPath));
+        return;
+    }
+
+    // the session may have changed while loading, copies within the folder
+    // and name clashes are resolved in file name order
+    QSet<QByteArray> knownHashes;
+    for (PayloadRef const& payload: files)
+        knownHashes.insert(payload->hash);
+    QSet<QString> names;
+    for (QString const& name: gameSession.submarinesList(GameSession::AvailableSubmarine))
+        names.insert(name);
+    QVector<EditJournal::Import> imports;
+    QVector<PayloadRef> payloads;
+    QStringList subNames;
+    QStringList problems;
+    int duplicates = 0;
+    for (SubmarineImport::Result const& result: results) {
+        if (!result.error.isEmpty()) {
+            problems.push_back(QString("%1: %2").arg(result.fileName, result.error));
+            continue;
+        }
+        if (result.duplicate || knownHashes.contains(result.hash)) {
+            duplicates++;
+            continue;
+        }
+        QString subName = QFileInfo(result.fileName).completeBaseName();
+        if (files.contains(result.fileName) || names.contains(subName)) {
+            problems.push_back(tr("%1: submarine with this name already exists").arg(result.fileName));
+            continue;
+        }
+        knownHashes.insert(result.hash);
+        names.insert(subName);
+        imports.push_back({result.fileName, result.hash, result.payload->data});
+        payloads.push_back(result.payload);
+        subNames.push_back(subName);
+    }
+
+    // nothing is journaled until the session took the submarines
+    QStringList added;
+    try {
+        journal->storeBlobs(imports);
+        added = gameSession.addSubmarines(subNames, GameSession::AvailableSubmarine);
+    } catch (std::runtime_error const& e) {
+        displayError(e.what());
+        return;
+    }
+    journal->recordImports(imports);
+    for (int i = 0; i < imports.size(); i++)
+        files.insert(imports.at(i).fileName, payloads.at(i));
+    changeCount += imports.size();
+    for (QString const& subName: added) {
+        journal->recordEdit(GameSession::Edit::addSubmarine(subName, GameSession::AvailableSubmarine));
+        changeCount++;
+        addSubItem(ui->availableSubsList, subName);
+    }
+
+    QString summary = tr("Imported %1 of %2 submarine files, %3 already in the save.")
+            .arg(imports.size()).arg(results.size()).arg(duplicates);
+    if (!problems.isEmpty())
+        summary += "\n\n" + problems.join('\n');
+    QMessageBox::information(this, tr("Import submarines"), summary);
+}
+
 void GameSessionEditor::on_removeAvailableSubsButton_clicked() {
     QList<QListWidgetItem*> selectedItems = ui->availableSubsList->selectedItems();
 
@@ -125,10 +395,10 @@ void GameSessionEditor::on_removeAvailableSubsButton_clicked() {
     // remove selected subs
     for (QListWidgetItem* pItem: selectedItems) {
         // remove from game session
-        gameSession.removeSubmarine(pItem->text(), GameSession::AvailableSubmarine);
-        // conditionally remove .sub file from workspace
-        if (!gameSession.containsSubmarine(pItem->text()))
-            removeFromWorkspace(pItem->text() + subExt);
+        applyEdit(GameSession::Edit::removeSubmarine(pItem->text(), GameSession::AvailableSubmarine));
+        // conditionally remove .sub file from the save
+        if (!gameSession.containsSubmarine(pItem->text()) && files.contains(pItem->text() + subExt))
+            removeFile(pItem->text() + subExt);
         // remove from GUI
         delete pItem;
     }
@@ -170,10 +440,10 @@ void GameSessionEditor::on_removeOwnedSubsButton_clicked()
             );
         } else {
             // remove from game session
-            gameSession.removeSubmarine(pItem->text(), GameSession::OwnedSubmarine);
-            // conditionally remove .sub file from workspace
-            if (!gameSession.containsSubmarine(pItem->text()))
-                removeFromWorkspace(pItem->text() + subExt);
+            applyEdit(GameSession::Edit::removeSubmarine(pItem->text(), GameSession::OwnedSubmarine));
+            // conditionally remove .sub file from the save
+            if (!gameSession.containsSubmarine(pItem->text()) && files.contains(pItem->text() + subExt))
+                removeFile(pItem->text() + subExt);
             // remove from GUI
             delete pItem;
         }
@@ -196,9 +466,9 @@ void GameSessionEditor::on_transferSubsButton_clicked()
     }
     bool hadDuplicates = false;
     for (QListWidgetItem* pItem: selectedItems) {
-        bool success = gameSession.addSubmarine(pItem->text(), GameSession::OwnedSubmarine);
+        bool success = applyEdit(GameSession::Edit::addSubmarine(pItem->text(), GameSession::OwnedSubmarine));
         if (success)
-            ui->ownedSubsList->addItem(pItem->text());
+            addSubItem(ui->ownedSubsList, pItem->text());
         else
             hadDuplicates = true;
     }
@@ -212,14 +482,35 @@ void GameSessionEditor::on_transferSubsButton_clicked()
     }
 }
 
+void GameSessionEditor::on_copySubsButton_clicked()
+{
+    QStringList names;
+    for (QListWidgetItem* pItem: ui->availableSubsList->selectedItems())
+        names.push_back(pItem->text());
+    if (names.isEmpty()) {
+        QMessageBox::information(
+                    this,
+                    tr("You selected nothing"),
+                    tr("Select the submarines to copy first")
+        );
+        return;
+    }
+    emit copySubmarinesRequested(names);
+}
+
 void GameSessionEditor::resetUI() {
+    subIcons.clear();
     ui->availableSubsList->clear();
     ui->ownedSubsList->clear();
     ui->label_filename->setText(tr("No file"));
 }
 
-void GameSessionEditor::openFile() {
-    if (!openedFilePath.isEmpty()) {
+// @returns bool: true when a save was loaded
+bool GameSessionEditor::openFile() {
+    // the result of a running save belongs to the current session
+    finishPendingWrite();
+    cancelImport();
+    if (hasUnsavedChanges()) {
         QMessageBox msgBox;
         msgBox.setText(tr("Loading another save file will discard your changes."));
         msgBox.setInformativeText(tr("Do you want to proceed?"));
@@ -227,7 +518,7 @@ void GameSessionEditor::openFile() {
         msgBox.setDefaultButton(QMessageBox::No);
         int ret = msgBox.exec();
         if (ret != QMessageBox::Yes)
-            return;
+            return false;
     }
     QChar separator = QDir::separator();
     // save location, taken from:
@@ -244,46 +535,130 @@ void GameSessionEditor::openFile() {
                 tr("Savegame file (*.save)")
     );
     if (filePath == "")
-        return;
-    // extract save file to workspace
+        return false;
+    // read save file into memory
+    MemoryAccounting::Operation accounting("open");
     try {
-        SaveUtil::decompressToDirectory(filePath, workspacePath);
+        loadSave(filePath);
     } catch (std::runtime_error const& e){
         displayError(e.what());
         emit sessionLoaded(false);
         openedFilePath = QString();
-        return;
+        return false;
     }
 
     // make sure UI is clean
     resetUI();
-
-    // process extracted data
-    processSessionFiles(workspacePath);
+    populateForms();
+    // reports are for builds made to measure memory use (CONFIG+=memory_accounting)
+    if (MemoryAccounting::heapHookEnabled())
+        qInfo().noquote() << accounting.report().toString();
 
     // save the edited file path on success
     openedFilePath = filePath;
+    savedChangeCount = changeCount;
+
+    // journal edits made from now on
+    try {
+        journal->start(openedFilePath, openedFilePath);
+    } catch (std::runtime_error const& e) {
+        displayError(e.what());
+    }
     QLabel* labelFilename = findChild<QLabel*>("label_filename");
     labelFilename->setText(filePath);
 
     // inform other widgets that the session was successfully loaded
     // so that they can be enabled for editing
     emit sessionLoaded(true);
+    return true;
+}
+
+/* Write snapshot of the session to a save archive
+ * Runs on a worker thread, must not touch the editor.
+ * @param files: files stored alongside gamesession.xml
+ */
+GameSessionEditor::SaveResult GameSessionEditor::writeSnapshot(const GameSession::Snapshot &snapshot,
+                                                               const QMap<QString, PayloadRef> &files,
+                                                               const QString &outFilePath) {
+    SaveResult result;
+    MemoryAccounting::Operation accounting("save");
+    MemoryAccounting::Buffer xmlCharge; // held until the archive is written
+    try {
+        result.xml = snapshot.toXML(&xmlCharge);
+        QVector<SaveUtil::MemoryFile> memoryFiles;
+        memoryFiles.reserve(files.size() + 1);
+        for (auto it = files.constBegin(); it != files.constEnd(); ++it) {
+            memoryFiles.push_back(SaveUtil::MemoryFile{it.key(), it.value()->data});
+        }
+        memoryFiles.push_back(SaveUtil::MemoryFile{gameSessionFileName, result.xml});
+        SaveUtil::compressFiles(QStringList(), memoryFiles, outFilePath);
+    } catch (std::runtime_error const& e) {
+        result.error = e.what();
+    }
+    if (MemoryAccounting::heapHookEnabled())
+        qInfo().noquote() << accounting.report().toString();
+    return result;
 }
 
 void GameSessionEditor::saveFile() {
-    // write changes made to session in editor
-    gameSession.dumpXML();
+    if (writePending) {
+        QMessageBox::information(
+                    this,
+                    tr("Save in progress"),
+                    tr("The game session is still being saved, try again in a moment.")
+        );
+        return;
+    }
+    startWrite(gameSession.snapshot(), openedFilePath, false);
+}
 
-    // compress directory and overwrite opened savegame
-    try {
-        SaveUtil::compressDirectory(workspacePath, openedFilePath);
-    } catch(std::runtime_error const& e) {
-        QErrorMessage em(this);
-        em.showMessage(e.what());
-        em.exec();
+// Write snapshot in the background, editing can continue meanwhile
+void GameSessionEditor::startWrite(const GameSession::Snapshot &snapshot, const QString &outFilePath, bool checkpoint) {
+    savingSnapshot = snapshot;
+    savingChangeCount = changeCount;
+    writingCheckpoint = checkpoint;
+    writePending = true;
+    QMap<QString, PayloadRef> savingFiles = files;
+    saveWatcher->setFuture(QtConcurrent::run([snapshot, savingFiles, outFilePath]() {
+        return writeSnapshot(snapshot, savingFiles, outFilePath);
+    }));
+}
+
+// Wait for a running write and handle its result now instead of on the queued signal
+void GameSessionEditor::finishPendingWrite() {
+    if (!writePending)
+        return;
+    saveWatcher->waitForFinished();
+    saveFinished();
+}
+
+void GameSessionEditor::saveFinished() {
+    // already handled by finishPendingWrite
+    if (!writePending)
+        return;
+    writePending = false;
+    SaveResult result = saveWatcher->result();
+    if (!result.error.isEmpty()) {
+        if (writingCheckpoint)
+            journal->compactionFailed();
+        displayError(result.error);
         return;
     }
+    gameSession.rebase(savingSnapshot, result.xml);
+    if (writingCheckpoint) {
+        checkpointFinished();
+        return;
+    }
+    savedChangeCount = savingChangeCount;
+    // everything is on disk now, start over with an empty journal
+    // (edits made during the save stay journaled, replaying them again is harmless)
+    if (changeCount == savingChangeCount) {
+        try {
+            journal->start(openedFilePath, openedFilePath);
+        } catch (std::runtime_error const& e) {
+            displayError(e.what());
+        }
+    }
     QMessageBox::information(
                 this,
                 tr("Save successful"),
@@ -299,6 +674,70 @@ void GameSessionEditor::on_availableSubsList_itemSelectionChanged()
 void GameSessionEditor::on_moneyEdit_textEdited(const QString &arg1)
 {
     qlonglong val = arg1.toLongLong();
-    gameSession.setMoney(val);
+    applyEdit(GameSession::Edit::setMoney(val));
     ui->moneyEdit->setText(QString::number(val));
 }
+
+// Checkpoint the session when the journal grows too large
+// The opened save file is left untouched until the user saves explicitly.
+void GameSessionEditor::compactJournal() {
+    if (openedFilePath.isEmpty())
+        return;
+    if (writePending) {
+        QTimer::singleShot(1000, this, SLOT(compactJournal()));
+        return;
+    }
+    // the checkpoint is replaced atomically, replaying the old journal onto the new one is harmless
+    startWrite(gameSession.snapshot(), journal->checkpointPath(), true);
+}
+
+// Continue journaling on top of the checkpoint written in the background
+void GameSessionEditor::checkpointFinished() {
+    // edits made during the write are only in the old journal, checkpoint again later
+    if (changeCount != savingChangeCount) {
+        QTimer::singleShot(1000, this, SLOT(compactJournal()));
+        return;
+    }
+    try {
+        journal->start(openedFilePath, journal->checkpointPath());
+    } catch (std::runtime_error const& e) {
+        displayError(e.what());
+    }
+}
+
+/* Offer to recover edits left in the journal by a crashed session
+ * @returns bool: true when a session was recovered
+ */
+bool GameSessionEditor::recoverSession() {
+    EditJournal::Contents contents;
+    if (!journal->load(contents) || contents.records.isEmpty()) {
+        journal->discard();
+        return false;
+    }
+    int choice = QMessageBox::question(
+                this,
+                tr("Recover unsaved changes"),
+                tr("The editor was closed unexpectedly while editing \"%1\". "
+                   "Do you want to recover unsaved changes?").arg(contents.targetPath)
+    );
+    if (choice != QMessageBox::Yes) {
+        journal->discard();
+        return false;
+    }
+    try {
+        loadSave(contents.basePath);
+        resetUI();
+        replayJournal(contents);
+        journal->resume();
+    } catch (std::runtime_error const& e) {
+        displayError(e.what());
+        journal->discard();
+        emit sessionLoaded(false);
+        return false;
+    }
+    populateForms();
+    openedFilePath = contents.targetPath;
+    ui->label_filename->setText(openedFilePath);
+    emit sessionLoaded(true);
+    return true;
+}
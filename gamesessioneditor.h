@@ -1,48 +1,112 @@
 #ifndef GAMESESSIONEDITOR_H
 #define GAMESESSIONEDITOR_H
 
+#include <QFutureWatcher>
+#include <QHash>
+#include <QIcon>
+#include <QMap>
+#include <QStringList>
 #include <QWidget>
 
+#include <editjournal.h>
 #include <gamesession.h>
+#include <payloadstore.h>
+#include <subimport.h>
+#include <thumbnailcache.h>
+
+class QListWidget;
 
 namespace Ui {
     class GameSessionEditor;
 }
 
+/* Editor of a single opened save
+ * Files stored in the save are held as payloads of the shared PayloadStore,
+ * so several editors can be open at once without duplicating contents.
+ */
 class GameSessionEditor : public QWidget
 {
     Q_OBJECT
 public:
-    explicit GameSessionEditor(QWidget *parent = nullptr);
+    explicit GameSessionEditor(QString const& journalDir, QWidget *parent = nullptr);
+    ~GameSessionEditor() override;
+
+    QString filePath() const;
+    QString journalDirectory() const;
+    bool hasSession() const;
+    bool hasUnsavedChanges() const;
+    QMap<QString, PayloadRef> submarinePayloads(QStringList const& names) const;
+    int importSubmarines(QMap<QString, PayloadRef> const& submarines);
 
 private:
-    void processSessionFiles(QString const& dir);
+    // outcome of writing a session snapshot
+    struct SaveResult {
+        QByteArray xml; // gamesession.xml as written
+        QString error;  // empty on success
+    };
+
+    static SaveResult writeSnapshot(GameSession::Snapshot const& snapshot, QMap<QString, PayloadRef> const& files,
+                                    QString const& outFilePath);
+    void loadSave(QString const& filePath);
+    void populateForms();
+    void addSubItem(QListWidget* list, QString const& name);
+    bool applyEdit(GameSession::Edit const& edit);
+    void replayJournal(EditJournal::Contents const& contents);
     void enableAllChildWidgets();
-    void displayError(QString const& message);
-    bool removeFromWorkspace(QString const& fileName);
+    void addFile(QString const& fileName, PayloadRef const& payload);
+    void removeFile(QString const& fileName);
+    void startWrite(GameSession::Snapshot const& snapshot, QString const& outFilePath, bool checkpoint);
+    void finishPendingWrite();
+    void checkpointFinished();
+    void cancelImport();
 
 signals:
     void sessionLoaded(bool);
+    // user wants the submarines copied into another opened save
+    void copySubmarinesRequested(QStringList const& names);
 
 private slots:
     void on_addSubButton_clicked();
+    void on_importSubsButton_clicked();
     void on_removeAvailableSubsButton_clicked();
     void on_removeOwnedSubsButton_clicked();
     void on_transferSubsButton_clicked();
+    void on_copySubsButton_clicked();
     void on_availableSubsList_itemSelectionChanged();
     void resetUI();
 
     void on_moneyEdit_textEdited(const QString &arg1);
+    void compactJournal();
+    void showThumbnail(QString const& key, QImage const& image);
+    void saveFinished();
+    void importFinished();
+    void displayError(QString const& message);
 
 public slots:
-    void openFile();
+    bool openFile();
     void saveFile();
+    bool recoverSession();
 
 private:
     Ui::GameSessionEditor* ui;
-    static const QString workspacePath;
+    QString journalDir;
     QString openedFilePath; // path to the file being edited
     GameSession gameSession;
+    QMap<QString, PayloadRef> files; // files stored with gamesession.xml, by file name
+    EditJournal* journal;
+    ThumbnailCache* thumbnails;
+    QHash<QString, QIcon> subIcons; // finished thumbnails by payload hash
+    QIcon placeholderIcon;
+    QFutureWatcher<SaveResult>* saveWatcher;
+    GameSession::Snapshot savingSnapshot; // snapshot being written by saveWatcher
+    bool writePending = false;      // saveWatcher result was not handled yet
+    bool writingCheckpoint = false; // saveWatcher writes a journal checkpoint, not the save
+    QFutureWatcher<SubmarineImport::Result>* importWatcher;
+    QString importDirPath; // folder being imported by importWatcher
+    bool importPending = false;
+    quint64 changeCount = 0;       // journaled changes made so far
+    quint64 savingChangeCount = 0; // changeCount when savingSnapshot was taken
+    quint64 savedChangeCount = 0;  // changeCount when the session was last saved or opened
 };
 
 #endif // GAMESESSIONEDITOR_H
@@ -0,0 +1,185 @@
+#include "locationindex.h"
+
+#include <QDomNodeList>
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+
+// from
+// https://github.com/Regalis11/Barotrauma/blob/4978af3d602730de2e2742af8541ef43b227efe9/Barotrauma/BarotraumaShared/SharedSource/Map/Map/Location.cs
+static const QString locationTagName = "location";
+static const QString storeTagName = "store";
+static const QString stockItemTagName = "item";
+static const int gridCellsPerSide = 32; // cells along the longer side of the map
+
+// "x,y" as written by XMLExtensions.Vector2ToString
+static QPointF parsePosition(QString const& value) {
+    QStringList parts = value.split(',');
+    if (parts.size() != 2)
+        return QPointF();
+    return QPointF(parts.at(0).trimmed().toDouble(), parts.at(1).trimmed().toDouble());
+}
+
+bool LocationIndex::Filter::matches(const Location &location) const {
+    if (!type.isEmpty() && location.type != type.toLower())
+        return false;
+    if (!name.isEmpty() && location.name != name)
+        return false;
+    if (radius >= 0) {
+        QPointF offset = location.position - center;
+        if (QPointF::dotProduct(offset, offset) > radius * radius)
+            return false;
+    }
+    return true;
+}
+
+// Index all locations of the campaign map in a single pass over the tree
+void LocationIndex::build(const QDomDocument &tree) {
+    clear();
+    QDomNodeList nodes = tree.elementsByTagName(locationTagName);
+    locations.reserve(nodes.size());
+    QPointF min, max;
+    for (int i = 0; i < nodes.size(); i++) {
+        Location location;
+        location.element = nodes.item(i).toElement();
+        location.name = location.element.attribute("name");
+        location.type = location.element.attribute("type").toLower();
+        location.position = parsePosition(location.element.attribute("position"));
+        location.store = location.element.firstChildElement(storeTagName);
+        if (locations.isEmpty()) {
+            min = max = location.position;
+        } else {
+            min.setX(std::min(min.x(), location.position.x()));
+            min.setY(std::min(min.y(), location.position.y()));
+            max.setX(std::max(max.x(), location.position.x()));
+            max.setY(std::max(max.y(), location.position.y()));
+        }
+        byName.insert(location.name, locations.size());
+        byType.insert(location.type, locations.size());
+        locations.push_back(location);
+    }
+
+    QPointF extent = max - min;
+    cellSize = std::max(1.0, std::max(extent.x(), extent.y()) / gridCellsPerSide);
+    minCell = cellOf(min);
+    maxCell = cellOf(max);
+    for (int i = 0; i < locations.size(); i++) {
+        grid[cellOf(locations.at(i).position)].push_back(i);
+    }
+    built = true;
+}
+
+void LocationIndex::clear() {
+    locations.clear();
+    byName.clear();
+    byType.clear();
+    grid.clear();
+    minCell = maxCell = Cell(0, 0);
+    cellSize = 1;
+    built = false;
+}
+
+/* Find locations matched by filter
+ * Candidates come from the most selective index (name, then position, then type).
+ * @returns QVector<int>: indices of matching locations, in document order
+ */
+QVector<int> LocationIndex::select(const Filter &filter) const {
+    QVector<int> candidates;
+    if (!filter.name.isEmpty()) {
+        candidates = byName.values(filter.name).toVector();
+    } else if (filter.radius >= 0) {
+        Cell first = cellOf(filter.center - QPointF(filter.radius, filter.radius));
+        Cell last = cellOf(filter.center + QPointF(filter.radius, filter.radius));
+        // only cells that can hold locations
+        first = Cell(std::max(first.first, minCell.first), std::max(first.second, minCell.second));
+        last = Cell(std::min(last.first, maxCell.first), std::min(last.second, maxCell.second));
+        for (int x = first.first; x <= last.first; x++) {
+            for (int y = first.second; y <= last.second; y++) {
+                auto cell = grid.constFind(Cell(x, y));
+                if (cell != grid.constEnd())
+                    candidates += *cell;
+            }
+        }
+    } else if (!filter.type.isEmpty()) {
+        candidates = byType.values(filter.type.toLower()).toVector();
+    } else {
+        candidates.reserve(locations.size());
+        for (int i = 0; i < locations.size(); i++)
+            candidates.push_back(i);
+    }
+
+    QVector<int> matches;
+    for (int index: candidates) {
+        if (filter.matches(locations.at(index)))
+            matches.push_back(index);
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+/* Apply edits in a single pass over the affected locations
+ * Every location is visited once, edits matching it are applied in order.
+ * @param changedBy: set to whether each edit changed any location, may be null
+ * @returns int: number of locations changed
+ */
+int LocationIndex::apply(const QVector<Edit> &edits, QVector<bool>* changedBy) {
+    QVector<int> affected;
+    for (Edit const& edit: edits) {
+        affected += select(edit.filter);
+    }
+    std::sort(affected.begin(), affected.end());
+    affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+    if (changedBy)
+        changedBy->fill(false, edits.size());
+    int changed = 0;
+    for (int index: affected) {
+        Location& location = locations[index];
+        bool locationChanged = false;
+        for (int i = 0; i < edits.size(); i++) {
+            if (edits.at(i).filter.matches(location) && applyTo(location, edits.at(i))) {
+                locationChanged = true;
+                if (changedBy)
+                    (*changedBy)[i] = true;
+            }
+        }
+        if (locationChanged)
+            changed++;
+    }
+    return changed;
+}
+
+LocationIndex::Cell LocationIndex::cellOf(const QPointF &position) const {
+    // far away points are clamped, they are outside of the grid anyway
+    const double limit = 1e9;
+    return Cell(static_cast<int>(std::floor(qBound(-limit, position.x() / cellSize, limit))),
+                static_cast<int>(std::floor(qBound(-limit, position.y() / cellSize, limit))));
+}
+
+// @returns bool: false when the location can't take the edit (e.g. it has no store)
+bool LocationIndex::applyTo(Location &location, const Edit &edit) {
+    switch (edit.action) {
+    case Edit::SetReputation:
+        location.element.setAttribute("reputation", edit.value);
+        return true;
+    case Edit::SetStoreBalance:
+        location.element.setAttribute("storebalance", static_cast<qlonglong>(edit.value));
+        return true;
+    case Edit::Restock: {
+        if (location.store.isNull() || edit.item.isEmpty())
+            return false;
+        QDomElement stock = location.store.firstChildElement(stockItemTagName);
+        while (!stock.isNull() && stock.attribute("id") != edit.item)
+            stock = stock.nextSiblingElement(stockItemTagName);
+        if (stock.isNull()) {
+            stock = location.store.ownerDocument().createElement(stockItemTagName);
+            stock.setAttribute("id", edit.item);
+            location.store.appendChild(stock);
+        }
+        stock.setAttribute("qty", static_cast<int>(edit.value));
+        return true;
+    }
+    }
+    return false;
+}
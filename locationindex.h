@@ -0,0 +1,76 @@
+#ifndef LOCATIONINDEX_H
+#define LOCATIONINDEX_H
+
+#include <QDomDocument>
+#include <QDomElement>
+#include <QHash>
+#include <QMultiHash>
+#include <QPair>
+#include <QPointF>
+#include <QString>
+#include <QVector>
+
+/* Index of campaign map locations in gamesession.xml
+ * All <location> elements are visited once and indexed by name, type and
+ * position (uniform grid), so edits of many locations don't have to search
+ * the DOM for every node. The index keeps handles to the elements, it stays
+ * valid while the tree is edited but must be rebuilt when it's replaced.
+ */
+class LocationIndex
+{
+public:
+    struct Location {
+        QDomElement element;
+        QString name;
+        QString type;      // location type identifier, lower case
+        QPointF position;  // position on the campaign map
+        QDomElement store; // store stock, null when the location has none
+    };
+
+    // Selects locations, empty fields match anything
+    struct Filter {
+        QString type;
+        QString name;
+        QPointF center;
+        double radius = -1; // negative for any distance from center
+
+        bool matches(Location const& location) const;
+    };
+
+    // Change applied to every location matched by filter
+    struct Edit {
+        enum Action {
+            SetReputation,
+            SetStoreBalance,
+            Restock         // set stock of item to value
+        };
+        Action action = SetReputation;
+        Filter filter;
+        double value = 0;
+        QString item; // item identifier, Restock only
+    };
+
+    void build(QDomDocument const& tree);
+    void clear();
+    bool isBuilt() const { return built; }
+    int size() const { return locations.size(); }
+    Location const& at(int index) const { return locations.at(index); }
+
+    QVector<int> select(Filter const& filter) const;
+    int apply(QVector<Edit> const& edits, QVector<bool>* changedBy = nullptr);
+
+private:
+    typedef QPair<int, int> Cell;
+    Cell cellOf(QPointF const& position) const;
+    bool applyTo(Location& location, Edit const& edit);
+
+    QVector<Location> locations;
+    QMultiHash<QString, int> byName;
+    QMultiHash<QString, int> byType;
+    QHash<Cell, QVector<int>> grid;
+    Cell minCell, maxCell; // bounds of occupied cells
+    double cellSize = 1;
+    bool built = false;
+};
+
+#endif // LOCATIONINDEX_H
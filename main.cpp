@@ -1,8 +1,75 @@
 #include "mainwindow.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTextStream>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <memoryaccounting.h>
+#include <savedaemon.h>
+
+// Run without GUI: serve save jobs on a local socket or send a single job to a running daemon
+static int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption daemonOption("daemon", "Process save jobs received on local socket <name>.", "name");
+    QCommandLineOption libraryOption("sub-library", "Directory with .sub files available to addSub jobs.", "dir");
+    QCommandLineOption requestOption("request", "Send a job to the daemon listening on <name> and print the response.", "name");
+    QCommandLineOption budgetOption("memory-budget", "Fail jobs that would need more than <MB> megabytes of buffers.", "MB");
+    parser.addOptions({daemonOption, libraryOption, requestOption, budgetOption});
+    parser.addPositionalArgument("json", "Job sent with --request, read from stdin when omitted.");
+    parser.process(a);
+
+    if (parser.isSet(requestOption)) {
+        QByteArray job = parser.positionalArguments().join(' ').toUtf8();
+        if (job.isEmpty())
+            job = QTextStream(stdin).readAll().toUtf8();
+        try {
+            std::cout << SaveDaemon::request(parser.value(requestOption), job).toStdString() << std::endl;
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (parser.isSet(budgetOption)) {
+        bool ok = false;
+        quint64 megabytes = parser.value(budgetOption).toULongLong(&ok);
+        if (!ok) {
+            std::cerr << "Invalid memory budget \"" << parser.value(budgetOption).toStdString() << "\"" << std::endl;
+            return 1;
+        }
+        MemoryAccounting::setBudget(megabytes * 1024 * 1024);
+    }
+
+    SaveDaemon daemon(parser.value(libraryOption));
+    if (!daemon.listen(parser.value(daemonOption))) {
+        std::cerr << "Could not listen on \"" << parser.value(daemonOption).toStdString() << "\": "
+                  << daemon.errorString().toStdString() << std::endl;
+        return 1;
+    }
+    return a.exec();
+}
+
+// @returns bool: true if arg is the option name, alone or as "name=value" like QCommandLineParser accepts
+static bool isOption(const char* arg, const char* name)
+{
+    size_t length = strlen(name);
+    return strncmp(arg, name, length) == 0 && (arg[length] == '\0' || arg[length] == '=');
+}
 
 int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; i++) {
+        if (isOption(argv[i], "--daemon") || isOption(argv[i], "--request"))
+            return runHeadless(argc, argv);
+    }
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
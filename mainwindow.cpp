@@ -1,30 +1,214 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include <QCloseEvent>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <QSet>
+#include <QTabWidget>
+#include <QTimer>
+
+#include <payloadstore.h>
+
+// every editor journals its edits in its own subdirectory
+static const QString journalRoot = "journal";
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
-    gse = new GameSessionEditor(ui->centralWidget);
-    this->setCentralWidget(gse);
-//    gse->setFocus();
+    tabs = new QTabWidget(ui->centralWidget);
+    tabs->setTabsClosable(true);
+    tabs->setDocumentMode(true);
+    this->setCentralWidget(tabs);
     QFile styleSheet(":/style/stylesheet.css");
     if (styleSheet.open(QFile::ReadOnly))
         this->setStyleSheet(styleSheet.readAll());
     else {
         throw 0;
     }
-    // connect toolbar buttons with editor widget(s)
-    connect(gse, SIGNAL(sessionLoaded(bool)), ui->actionSave, SLOT(setEnabled(bool)));
-    connect(ui->actionSave, SIGNAL(triggered()), gse, SLOT(saveFile()));
-    connect(ui->actionOpen_saved_game, SIGNAL(triggered()), gse, SLOT(openFile()));
+    // connect toolbar buttons with the editor of the current tab
+    connect(ui->actionSave, SIGNAL(triggered()), this, SLOT(saveFile()));
+    connect(ui->actionOpen_saved_game, SIGNAL(triggered()), this, SLOT(openFile()));
+    connect(tabs, SIGNAL(currentChanged(int)), this, SLOT(updateActions()));
+    connect(tabs, SIGNAL(tabCloseRequested(int)), this, SLOT(closeTab(int)));
+    // offer recovery of crashed sessions once the window is shown
+    QTimer::singleShot(0, this, SLOT(recoverSessions()));
 }
 
 MainWindow::~MainWindow()
 {
-    delete gse;
+    delete tabs;
     delete ui;
 }
+
+// Closing the window closes every tab, ask once if any of them has unsaved changes
+void MainWindow::closeEvent(QCloseEvent *event) {
+    QStringList unsaved;
+    for (int i = 0; i < tabs->count(); i++) {
+        GameSessionEditor* editor = editorAt(i);
+        if (editor != nullptr && editor->hasUnsavedChanges())
+            unsaved.push_back(tabs->tabText(i));
+    }
+    if (!unsaved.isEmpty()) {
+        int choice = QMessageBox::question(
+                    this,
+                    tr("Unsaved changes"),
+                    tr("Closing the editor will discard your changes to:\n%1\nDo you want to proceed?")
+                        .arg(unsaved.join('\n'))
+        );
+        if (choice != QMessageBox::Yes) {
+            event->ignore();
+            return;
+        }
+    }
+    event->accept();
+}
+
+// Open a save in the current tab if it's empty, in a new tab otherwise
+void MainWindow::openFile() {
+    GameSessionEditor* editor = currentEditor();
+    bool reused = editor != nullptr && !editor->hasSession();
+    if (!reused)
+        editor = addEditor(freeJournalDir());
+    if (!editor->openFile() && !reused) {
+        tabs->removeTab(tabs->indexOf(editor));
+        delete editor;
+    }
+    updateActions();
+}
+
+void MainWindow::saveFile() {
+    GameSessionEditor* editor = currentEditor();
+    if (editor != nullptr && editor->hasSession())
+        editor->saveFile();
+}
+
+void MainWindow::closeTab(int index) {
+    GameSessionEditor* editor = editorAt(index);
+    if (editor == nullptr)
+        return;
+    if (editor->hasUnsavedChanges()) {
+        int choice = QMessageBox::question(
+                    this,
+                    tr("Unsaved changes"),
+                    tr("Closing \"%1\" will discard your changes. Do you want to proceed?").arg(tabs->tabText(index))
+        );
+        if (choice != QMessageBox::Yes)
+            return;
+    }
+    tabs->removeTab(index);
+    delete editor;
+    // keep an empty editor around, so there is always something to open a save in
+    if (tabs->count() == 0)
+        addEditor(freeJournalDir());
+    updateActions();
+    showStoreUsage();
+}
+
+void MainWindow::updateActions() {
+    GameSessionEditor* editor = currentEditor();
+    ui->actionSave->setEnabled(editor != nullptr && editor->hasSession());
+}
+
+void MainWindow::sessionLoaded(bool success) {
+    GameSessionEditor* editor = qobject_cast<GameSessionEditor*>(sender());
+    int index = tabs->indexOf(editor);
+    if (index < 0)
+        return;
+    if (success) {
+        tabs->setTabText(index, QFileInfo(editor->filePath()).fileName());
+        tabs->setTabToolTip(index, editor->filePath());
+    }
+    updateActions();
+    showStoreUsage();
+}
+
+// Copy submarines selected in one editor into the save opened in another one
+void MainWindow::copySubmarines(QStringList const& names) {
+    GameSessionEditor* source = qobject_cast<GameSessionEditor*>(sender());
+    if (source == nullptr)
+        return;
+    QStringList targetNames;
+    QVector<GameSessionEditor*> targets;
+    for (int i = 0; i < tabs->count(); i++) {
+        GameSessionEditor* editor = editorAt(i);
+        if (editor != source && editor->hasSession()) {
+            targetNames.push_back(editor->filePath());
+            targets.push_back(editor);
+        }
+    }
+    if (targets.isEmpty()) {
+        QMessageBox::information(
+                    this,
+                    tr("No other save opened"),
+                    tr("Open the save you want to copy the submarines into first")
+        );
+        return;
+    }
+    bool ok = false;
+    QString choice = QInputDialog::getItem(this, tr("Copy submarines"), tr("Copy selected submarines into:"),
+                                           targetNames, 0, false, &ok);
+    if (!ok)
+        return;
+    // payloads are handed over, contents are not copied
+    GameSessionEditor* target = targets.at(targetNames.indexOf(choice));
+    int copied = target->importSubmarines(source->submarinePayloads(names));
+    statusBar()->showMessage(tr("Copied %1 of %2 submarine(s) into \"%3\"").arg(copied).arg(names.size()).arg(choice), 5000);
+}
+
+// Open a tab for every journal left behind by a crashed session
+void MainWindow::recoverSessions() {
+    QDir journals(journalRoot);
+    for (QString const& dirName: journals.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+        GameSessionEditor* editor = addEditor(journalRoot + QDir::separator() + dirName);
+        if (!editor->recoverSession()) {
+            tabs->removeTab(tabs->indexOf(editor));
+            delete editor;
+        }
+    }
+    if (tabs->count() == 0)
+        addEditor(freeJournalDir());
+    updateActions();
+}
+
+GameSessionEditor* MainWindow::addEditor(QString const& journalDir) {
+    GameSessionEditor* editor = new GameSessionEditor(journalDir, tabs);
+    connect(editor, SIGNAL(sessionLoaded(bool)), this, SLOT(sessionLoaded(bool)));
+    connect(editor, SIGNAL(copySubmarinesRequested(QStringList)), this, SLOT(copySubmarines(QStringList)));
+    tabs->setCurrentIndex(tabs->addTab(editor, tr("No file")));
+    return editor;
+}
+
+GameSessionEditor* MainWindow::currentEditor() const {
+    return qobject_cast<GameSessionEditor*>(tabs->currentWidget());
+}
+
+GameSessionEditor* MainWindow::editorAt(int index) const {
+    return qobject_cast<GameSessionEditor*>(tabs->widget(index));
+}
+
+// @returns QString: journal directory not used by any opened editor
+QString MainWindow::freeJournalDir() const {
+    QSet<QString> used;
+    for (int i = 0; i < tabs->count(); i++) {
+        used.insert(editorAt(i)->journalDirectory());
+    }
+    for (int i = 0; ; i++) {
+        QString dir = journalRoot + QDir::separator() + QString::number(i);
+        if (!used.contains(dir))
+            return dir;
+    }
+}
+
+// Memory used by save contents grows with unique files, not with the number of opened saves
+void MainWindow::showStoreUsage() {
+    PayloadStore const& store = PayloadStore::shared();
+    statusBar()->showMessage(tr("%1 unique files in memory (%2 MB)")
+                             .arg(store.count())
+                             .arg(store.bytes() / (1024.0 * 1024.0), 0, 'f', 1));
+}
@@ -2,9 +2,13 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QStringList>
 
 #include <gamesessioneditor.h>
 
+class QCloseEvent;
+class QTabWidget;
+
 namespace Ui {
 class MainWindow;
 }
@@ -17,9 +21,27 @@ public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+protected:
+    void closeEvent(QCloseEvent* event) override;
+
+private slots:
+    void openFile();
+    void saveFile();
+    void closeTab(int index);
+    void updateActions();
+    void sessionLoaded(bool success);
+    void copySubmarines(QStringList const& names);
+    void recoverSessions();
+
 private:
+    GameSessionEditor* addEditor(QString const& journalDir);
+    GameSessionEditor* currentEditor() const;
+    GameSessionEditor* editorAt(int index) const;
+    QString freeJournalDir() const;
+    void showStoreUsage();
+
     Ui::MainWindow *ui;
-    GameSessionEditor *gse;
+    QTabWidget *tabs; // one GameSessionEditor per opened save
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,261 @@
+#include "memoryaccounting.h"
+
+#include <QJsonValue>
+#include <QStringList>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+namespace {
+
+// plain data only, operator new must be able to use it on any thread at any time
+struct ThreadState {
+    MemoryAccounting::Operation* operation;
+    MemoryAccounting::Stage stage;
+    qint64 live;     // bytes charged by this thread
+    qint64 heapLive; // operator new bytes allocated minus freed by this thread
+};
+
+thread_local ThreadState threadState = {nullptr, MemoryAccounting::Untracked, 0, 0};
+
+std::atomic<quint64> bytesInUse(0);
+std::atomic<quint64> budgetBytes(0); // 0 means unlimited
+
+const char* const stageNames[MemoryAccounting::StageCount] = {
+    "untracked",
+    "readArchive",
+    "inflate",
+    "buildArchive",
+    "deflate",
+    "parseXML",
+    "serializeXML"
+};
+
+QString megabytes(quint64 bytes) {
+    return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " MB";
+}
+
+quint64 aboveBase(qint64 live, qint64 base) {
+    return live > base ? static_cast<quint64>(live - base) : 0;
+}
+
+} // namespace
+
+MemoryAccounting::Buffer::Buffer(size_t bytes) {
+    resize(bytes);
+}
+
+MemoryAccounting::Buffer::~Buffer() {
+    release(charged);
+}
+
+/* Change the number of bytes held
+ * Call before growing the buffer itself, so the budget is checked before allocating.
+ * @throws std::runtime_error: when growing would exceed the memory budget
+ */
+void MemoryAccounting::Buffer::resize(size_t bytes) {
+    if (bytes > charged)
+        charge(bytes - charged);
+    else
+        release(charged - bytes);
+    charged = bytes;
+}
+
+MemoryAccounting::StageScope::StageScope(Stage stage) :
+    previous(threadState.stage)
+{
+    threadState.stage = stage;
+    // buffers held when entering count towards the stage high-water mark
+    charge(0);
+    heapAllocated(0);
+}
+
+MemoryAccounting::StageScope::~StageScope() {
+    threadState.stage = previous;
+}
+
+MemoryAccounting::Operation::Operation(const QString &name) :
+    previous(threadState.operation),
+    liveBase(threadState.live),
+    heapBase(threadState.heapLive)
+{
+    stats.operation = name;
+    threadState.operation = this;
+}
+
+MemoryAccounting::Operation::~Operation() {
+    threadState.operation = previous;
+}
+
+// Record bytes copied from one buffer to another by the current thread
+void MemoryAccounting::copied(size_t bytes) {
+    Operation* operation = threadState.operation;
+    if (operation)
+        operation->stats.stages[threadState.stage].copied += bytes;
+}
+
+// @param bytes: limit of bytes charged by all threads, 0 for no limit
+void MemoryAccounting::setBudget(quint64 bytes) {
+    budgetBytes.store(bytes, std::memory_order_relaxed);
+}
+
+quint64 MemoryAccounting::budget() {
+    return budgetBytes.load(std::memory_order_relaxed);
+}
+
+// @returns quint64: bytes charged by all threads
+quint64 MemoryAccounting::inUse() {
+    return bytesInUse.load(std::memory_order_relaxed);
+}
+
+bool MemoryAccounting::heapHookEnabled() {
+#ifdef SAVEEDITOR_MEMORY_ACCOUNTING
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* MemoryAccounting::stageName(Stage stage) {
+    return stage >= 0 && stage < StageCount ? stageNames[stage] : "unknown";
+}
+
+// @throws std::runtime_error: when bytes don't fit in the budget
+void MemoryAccounting::charge(size_t bytes) {
+    ThreadState& state = threadState;
+    if (bytes > 0) {
+        quint64 limit = budgetBytes.load(std::memory_order_relaxed);
+        quint64 before = bytesInUse.fetch_add(bytes, std::memory_order_relaxed);
+        if (limit != 0 && before + bytes > limit) {
+            bytesInUse.fetch_sub(bytes, std::memory_order_relaxed);
+            throw std::runtime_error(QString("Memory budget of %1 exceeded in stage \"%2\": %3 requested with %4 in use")
+                                     .arg(megabytes(limit), QString::fromLatin1(stageName(state.stage)), megabytes(bytes), megabytes(before))
+                                     .toStdString());
+        }
+        state.live += static_cast<qint64>(bytes);
+    }
+    Operation* operation = state.operation;
+    if (operation == nullptr)
+        return;
+    StageStats& stage = operation->stats.stages[state.stage];
+    quint64 live = aboveBase(state.live, operation->liveBase);
+    stage.allocated += bytes;
+    stage.peak = std::max(stage.peak, live);
+    operation->stats.peak = std::max(operation->stats.peak, live);
+}
+
+void MemoryAccounting::release(size_t bytes) {
+    if (bytes == 0)
+        return;
+    bytesInUse.fetch_sub(bytes, std::memory_order_relaxed);
+    threadState.live -= static_cast<qint64>(bytes);
+}
+
+// Must not allocate or throw, called from operator new
+void MemoryAccounting::heapAllocated(size_t bytes) {
+    ThreadState& state = threadState;
+    state.heapLive += static_cast<qint64>(bytes);
+    Operation* operation = state.operation;
+    if (operation == nullptr)
+        return;
+    StageStats& stage = operation->stats.stages[state.stage];
+    quint64 live = aboveBase(state.heapLive, operation->heapBase);
+    stage.heapAllocated += bytes;
+    stage.heapPeak = std::max(stage.heapPeak, live);
+    operation->stats.heapPeak = std::max(operation->stats.heapPeak, live);
+}
+
+// Must not allocate or throw, called from operator delete
+void MemoryAccounting::heapReleased(size_t bytes) {
+    threadState.heapLive -= static_cast<qint64>(bytes);
+}
+
+// Stages that saw any activity, keyed by stage name
+QJsonObject MemoryAccounting::Report::toJson() const {
+    bool heap = heapHookEnabled();
+    QJsonObject stageObjects;
+    for (int i = 0; i < StageCount; i++) {
+        StageStats const& stage = stages[i];
+        if (stage.allocated == 0 && stage.copied == 0 && stage.peak == 0 && stage.heapAllocated == 0)
+            continue;
+        QJsonObject object;
+        object.insert("allocated", static_cast<qint64>(stage.allocated));
+        object.insert("copied", static_cast<qint64>(stage.copied));
+        object.insert("peak", static_cast<qint64>(stage.peak));
+        if (heap) {
+            object.insert("heapAllocated", static_cast<qint64>(stage.heapAllocated));
+            object.insert("heapPeak", static_cast<qint64>(stage.heapPeak));
+        }
+        stageObjects.insert(stageName(static_cast<Stage>(i)), object);
+    }
+    QJsonObject result;
+    result.insert("operation", operation);
+    result.insert("peak", static_cast<qint64>(peak));
+    if (heap)
+        result.insert("heapPeak", static_cast<qint64>(heapPeak));
+    result.insert("stages", stageObjects);
+    return result;
+}
+
+// One line summary for logs
+QString MemoryAccounting::Report::toString() const {
+    bool heap = heapHookEnabled();
+    QStringList parts;
+    QString total = operation + ": peak " + megabytes(peak);
+    if (heap)
+        total += ", heap peak " + megabytes(heapPeak);
+    parts.push_back(total);
+    for (int i = 0; i < StageCount; i++) {
+        StageStats const& stage = stages[i];
+        if (stage.allocated == 0 && stage.copied == 0 && stage.peak == 0 && stage.heapAllocated == 0)
+            continue;
+        QString part = QString("%1: %2 allocated, %3 copied, peak %4")
+                .arg(QString::fromLatin1(stageName(static_cast<Stage>(i))), megabytes(stage.allocated),
+                     megabytes(stage.copied), megabytes(stage.peak));
+        if (heap)
+            part += QString(", heap %1 allocated, heap peak %2").arg(megabytes(stage.heapAllocated), megabytes(stage.heapPeak));
+        parts.push_back(part);
+    }
+    return parts.join("; ");
+}
+
+#ifdef SAVEEDITOR_MEMORY_ACCOUNTING
+// size of every block is kept in front of it, so operator delete can account for it
+static constexpr size_t heapHeader = alignof(std::max_align_t);
+
+void* operator new(size_t size) {
+    void* block = std::malloc(size + heapHeader);
+    if (block == nullptr)
+        throw std::bad_alloc();
+    *static_cast<size_t*>(block) = size;
+    MemoryAccounting::heapAllocated(size);
+    return static_cast<char*>(block) + heapHeader;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    if (pointer == nullptr)
+        return;
+    char* block = static_cast<char*>(pointer) - heapHeader;
+    MemoryAccounting::heapReleased(*reinterpret_cast<size_t*>(block));
+    std::free(block);
+}
+
+void operator delete[](void* pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+#endif
@@ -0,0 +1,110 @@
+#ifndef MEMORYACCOUNTING_H
+#define MEMORYACCOUNTING_H
+
+#include <QJsonObject>
+#include <QString>
+
+#include <cstddef>
+
+/* Memory accounting for the save processing pipeline
+ * Large buffers are charged to the stage of the current thread before they
+ * are allocated, so a configurable budget can stop a job with a clear error
+ * instead of letting the process get OOM-killed. Every operation collects
+ * bytes allocated, bytes copied and the high-water mark of each stage.
+ *
+ * Building with CONFIG+=memory_accounting also installs a counting global
+ * operator new, which adds the heap usage of everything else done in a
+ * stage (e.g. QDomDocument nodes) to the report. Heap figures are per
+ * thread, memory freed by another thread makes them approximate.
+ */
+class MemoryAccounting
+{
+public:
+    enum Stage {
+        Untracked,
+        ReadArchive,  // compressed save read into memory
+        Inflate,      // decompressor output
+        BuildArchive, // files read and packed for compression
+        Deflate,      // compressor output
+        ParseXML,     // QDomDocument built from gamesession.xml
+        SerializeXML, // QDomDocument written back to XML
+        StageCount
+    };
+
+    struct StageStats {
+        quint64 allocated = 0;     // bytes charged
+        quint64 copied = 0;        // bytes copied between buffers
+        quint64 peak = 0;          // high-water mark of charged bytes during the stage
+        quint64 heapAllocated = 0; // operator new, with CONFIG+=memory_accounting only
+        quint64 heapPeak = 0;
+    };
+
+    struct Report {
+        QString operation;
+        StageStats stages[StageCount];
+        quint64 peak = 0;
+        quint64 heapPeak = 0;
+
+        QJsonObject toJson() const;
+        QString toString() const;
+    };
+
+    // Bytes held by a buffer, released on destruction (on the same thread)
+    class Buffer {
+    public:
+        explicit Buffer(size_t bytes = 0);
+        ~Buffer();
+        Buffer(Buffer const&) = delete;
+        Buffer& operator=(Buffer const&) = delete;
+        void resize(size_t bytes);
+        size_t size() const { return charged; }
+    private:
+        size_t charged = 0;
+    };
+
+    // Attribute work done by the current thread to stage
+    class StageScope {
+    public:
+        explicit StageScope(Stage stage);
+        ~StageScope();
+        StageScope(StageScope const&) = delete;
+        StageScope& operator=(StageScope const&) = delete;
+    private:
+        Stage previous;
+    };
+
+    // Collect per stage usage of the current thread until destroyed
+    class Operation {
+    public:
+        explicit Operation(QString const& name);
+        ~Operation();
+        Operation(Operation const&) = delete;
+        Operation& operator=(Operation const&) = delete;
+        Report const& report() const { return stats; }
+    private:
+        friend class MemoryAccounting;
+        Report stats;
+        Operation* previous;
+        qint64 liveBase;
+        qint64 heapBase;
+    };
+
+    MemoryAccounting() = delete;
+
+    static void copied(size_t bytes);
+    static void setBudget(quint64 bytes);
+    static quint64 budget();
+    static quint64 inUse();
+    static bool heapHookEnabled();
+    static const char* stageName(Stage stage);
+
+    // used by the operator new hook
+    static void heapAllocated(size_t bytes);
+    static void heapReleased(size_t bytes);
+
+private:
+    static void charge(size_t bytes);
+    static void release(size_t bytes);
+};
+
+#endif // MEMORYACCOUNTING_H
@@ -0,0 +1,83 @@
+#include "payloadstore.h"
+
+#include <QCryptographicHash>
+#include <QMutexLocker>
+
+PayloadStore& PayloadStore::shared() {
+    static PayloadStore store;
+    return store;
+}
+
+/* Get payload with the given contents
+ * Data is hashed in place and copied only when the store doesn't have it yet.
+ */
+PayloadRef PayloadStore::intern(const char* data, size_t size) {
+    QCryptographicHash hasher(QCryptographicHash::Sha1);
+    hasher.addData(data, static_cast<int>(size));
+    QByteArray hash = hasher.result().toHex();
+    if (PayloadRef existing = find(hash))
+        return existing;
+    return insert(hash, QByteArray(data, static_cast<int>(size)));
+}
+
+// Like intern(const char*, size_t), but shares data instead of copying it
+PayloadRef PayloadStore::intern(const QByteArray &data) {
+    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    if (PayloadRef existing = find(hash))
+        return existing;
+    return insert(hash, data);
+}
+
+// For callers that hashed data already, hash must be its hex encoded SHA-1
+PayloadRef PayloadStore::intern(const QByteArray &data, const QByteArray &hash) {
+    if (PayloadRef existing = find(hash))
+        return existing;
+    return insert(hash, data);
+}
+
+// @returns PayloadRef: payload with the given content hash, null if it's not in the store
+PayloadRef PayloadStore::find(const QByteArray &hash) const {
+    QMutexLocker locker(&mutex);
+    auto it = payloads.constFind(hash);
+    return it != payloads.constEnd() ? it->lock() : PayloadRef();
+}
+
+// @returns int: number of distinct payloads held
+int PayloadStore::count() const {
+    QMutexLocker locker(&mutex);
+    return payloads.size();
+}
+
+// @returns qint64: size of distinct payloads held
+qint64 PayloadStore::bytes() const {
+    QMutexLocker locker(&mutex);
+    return totalBytes;
+}
+
+PayloadRef PayloadStore::insert(const QByteArray &hash, const QByteArray &data) {
+    QMutexLocker locker(&mutex);
+    // another thread may have added the same contents in the meantime
+    auto it = payloads.find(hash);
+    if (it != payloads.end()) {
+        if (PayloadRef existing = it->lock())
+            return existing;
+    }
+    PayloadRef payload(new Payload{hash, data}, [this](Payload const* released) {
+        release(released);
+    });
+    payloads.insert(hash, payload);
+    totalBytes += data.size();
+    return payload;
+}
+
+void PayloadStore::release(const Payload *payload) {
+    {
+        QMutexLocker locker(&mutex);
+        totalBytes -= payload->data.size();
+        // the hash may already refer to a new payload with the same contents
+        auto it = payloads.find(payload->hash);
+        if (it != payloads.end() && it->expired())
+            payloads.erase(it);
+    }
+    delete payload;
+}
@@ -0,0 +1,50 @@
+#ifndef PAYLOADSTORE_H
+#define PAYLOADSTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+#include <cstddef>
+#include <memory>
+
+// Contents of a file stored in a save archive
+struct Payload {
+    QByteArray hash; // SHA-1 of data, hex encoded
+    QByteArray data;
+};
+
+using PayloadRef = std::shared_ptr<const Payload>;
+
+/* Content addressed store of save archive entries
+ * Identical contents are kept in memory once, no matter how many open
+ * saves (or names within one save) refer to them. A payload is dropped
+ * when the last reference to it goes away. All methods are thread safe.
+ */
+class PayloadStore
+{
+public:
+    PayloadStore() = default;
+    PayloadStore(PayloadStore const&) = delete;
+    PayloadStore& operator=(PayloadStore const&) = delete;
+
+    PayloadRef intern(const char* data, size_t size);
+    PayloadRef intern(QByteArray const& data);
+    PayloadRef intern(QByteArray const& data, QByteArray const& hash);
+    PayloadRef find(QByteArray const& hash) const;
+    int count() const;
+    qint64 bytes() const;
+
+    // store shared by all documents of the process
+    static PayloadStore& shared();
+
+private:
+    PayloadRef insert(QByteArray const& hash, QByteArray const& data);
+    void release(Payload const* payload);
+
+    mutable QMutex mutex;
+    QHash<QByteArray, std::weak_ptr<const Payload>> payloads;
+    qint64 totalBytes = 0;
+};
+
+#endif // PAYLOADSTORE_H
@@ -0,0 +1,398 @@
+#include "savedaemon.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutexLocker>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#include <gamesession.h>
+#include <memoryaccounting.h>
+#include <saveindex.h>
+#include <saveutil.h>
+
+static const QString subExt = ".sub";
+
+// {"type": "outpost", "name": "<location>", "center": [x, y], "radius": 500}, all fields optional
+static LocationIndex::Filter locationFilterFromJson(QJsonObject const& object) {
+    LocationIndex::Filter filter;
+    filter.type = object.value("type").toString();
+    filter.name = object.value("name").toString();
+    if (object.contains("radius")) {
+        QJsonArray center = object.value("center").toArray();
+        if (center.size() != 2)
+            throw std::runtime_error("Location filter with \"radius\" needs a \"center\": [x, y]");
+        filter.center = QPointF(center.at(0).toDouble(), center.at(1).toDouble());
+        filter.radius = object.value("radius").toDouble();
+    }
+    return filter;
+}
+
+static QJsonObject locationToJson(LocationIndex::Location const& location) {
+    QJsonObject object;
+    object.insert("name", location.name);
+    object.insert("type", location.type);
+    object.insert("position", QJsonArray{location.position.x(), location.position.y()});
+    if (location.element.hasAttribute("reputation"))
+        object.insert("reputation", location.element.attribute("reputation").toDouble());
+    if (location.element.hasAttribute("storebalance"))
+        object.insert("storeBalance", location.element.attribute("storebalance").toLongLong());
+    return object;
+}
+
+/* {"type": "editLocations", "action": "setReputation" | "setStoreBalance" | "restock",
+ *  "value": 50, "item": "<item id, restock only>",
+ *  "filter": {"type": "outpost", "name": "<location>", "center": [x, y], "radius": 500}}
+ */
+static LocationIndex::Edit locationEditFromJson(QJsonObject const& object) {
+    LocationIndex::Edit edit;
+    QString action = object.value("action").toString();
+    if (action == "setReputation")
+        edit.action = LocationIndex::Edit::SetReputation;
+    else if (action == "setStoreBalance")
+        edit.action = LocationIndex::Edit::SetStoreBalance;
+    else if (action == "restock")
+        edit.action = LocationIndex::Edit::Restock;
+    else
+        throw std::runtime_error(("Unknown location action \"" + action + "\"").toStdString());
+    edit.value = object.value("value").toDouble();
+    edit.item = object.value("item").toString();
+    if (edit.action == LocationIndex::Edit::Restock && edit.item.isEmpty())
+        throw std::runtime_error("Location action \"restock\" needs an \"item\"");
+
+    edit.filter = locationFilterFromJson(object.value("filter").toObject());
+    return edit;
+}
+
+SaveDaemon::SaveDaemon(QString const& subLibraryPath, QObject* parent) :
+    QObject(parent),
+    server(new QLocalServer(this)),
+    subLibrary(subLibraryPath)
+{
+    // keep worker threads (and their zlib streams) alive between jobs
+    workers.setExpiryTimeout(-1);
+    subLibrary.refresh();
+    connect(server, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+}
+
+SaveDaemon::~SaveDaemon() {
+    server->close();
+    workers.waitForDone();
+}
+
+// Start accepting jobs on local socket socketName
+bool SaveDaemon::listen(const QString &socketName) {
+    // remove socket left behind by a daemon that was killed
+    QLocalServer::removeServer(socketName);
+    return server->listen(socketName);
+}
+
+QString SaveDaemon::errorString() const {
+    return server->errorString();
+}
+
+SaveDaemon::Stats SaveDaemon::stats() const {
+    Stats result;
+    {
+        QMutexLocker locker(&queueMutex);
+        result.queued = queuedJobs;
+        result.running = runningJobs;
+    }
+    QMutexLocker locker(&statsMutex);
+    result.completed = completedJobs;
+    result.failed = failedJobs;
+    qint64 finished = completedJobs + failedJobs;
+    result.meanLatencyMs = finished ? static_cast<double>(totalLatencyMs) / finished : 0.0;
+    result.maxLatencyMs = maxLatencyMs;
+    return result;
+}
+
+/* Send a single job to a running daemon and wait for the answer
+ * @returns QByteArray: JSON response line
+ * @throws std::runtime_error: when the daemon can't be reached or doesn't answer in time
+ */
+QByteArray SaveDaemon::request(const QString &socketName, const QByteArray &json, int timeoutMsec) {
+    QLocalSocket socket;
+    socket.connectToServer(socketName);
+    if (!socket.waitForConnected(timeoutMsec))
+        throw std::runtime_error(("Could not connect to \"" + socketName + "\": " + socket.errorString()).toStdString());
+    socket.write(json.trimmed() + '\n');
+    socket.waitForBytesWritten(timeoutMsec);
+    while (!socket.canReadLine()) {
+        if (!socket.waitForReadyRead(timeoutMsec))
+            throw std::runtime_error(("No response from \"" + socketName + "\": " + socket.errorString()).toStdString());
+    }
+    return socket.readLine().trimmed();
+}
+
+void SaveDaemon::acceptConnection() {
+    while (server->hasPendingConnections()) {
+        QLocalSocket* socket = server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequests()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void SaveDaemon::readRequests() {
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+    if (socket == nullptr)
+        return;
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        Job job;
+        job.received.start();
+        job.client = socket;
+        QJsonParseError parseError;
+        QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+        if (!document.isObject()) {
+            QJsonObject response;
+            response.insert("ok", false);
+            response.insert("error", "Invalid request: " + parseError.errorString());
+            respond(job.client, response);
+            continue;
+        }
+        job.request = document.object();
+        QString op = job.request.value("op").toString();
+        if (op == "stats") {
+            // answered right away, doesn't wait behind save jobs
+            QJsonObject response = statsToJson();
+            response.insert("ok", true);
+            if (job.request.contains("id"))
+                response.insert("id", job.request.value("id"));
+            respond(job.client, response);
+        } else if (job.request.value("save").toString().isEmpty()) {
+            QJsonObject response;
+            response.insert("ok", false);
+            response.insert("error", QString("Request has no \"save\" path"));
+            if (job.request.contains("id"))
+                response.insert("id", job.request.value("id"));
+            respond(job.client, response);
+        } else {
+            enqueue(job);
+        }
+    }
+}
+
+// Queue job behind other jobs for the same save
+void SaveDaemon::enqueue(const Job &job) {
+    QString savePath = QFileInfo(job.request.value("save").toString()).absoluteFilePath();
+    QMutexLocker locker(&queueMutex);
+    SaveQueue& queue = queues[savePath];
+    queue.jobs.enqueue(job);
+    queuedJobs++;
+    if (!queue.running) {
+        queue.running = true;
+        workers.start([this, savePath]() { drain(savePath); });
+    }
+}
+
+// Process jobs queued for savePath until there are none left (runs on a worker thread)
+void SaveDaemon::drain(const QString &savePath) {
+    for (;;) {
+        Job job;
+        {
+            QMutexLocker locker(&queueMutex);
+            SaveQueue& queue = queues[savePath];
+            if (queue.jobs.isEmpty()) {
+                queues.remove(savePath);
+                return;
+            }
+            job = queue.jobs.dequeue();
+            queuedJobs--;
+            runningJobs++;
+        }
+        QJsonObject response;
+        try {
+            response = process(job.request);
+        } catch (...) {
+            // nothing may escape the worker, the queue would stay marked as running
+            response = QJsonObject();
+            response.insert("ok", false);
+            response.insert("error", QString("Internal error"));
+        }
+        {
+            QMutexLocker locker(&queueMutex);
+            runningJobs--;
+        }
+        qint64 latency = job.received.elapsed();
+        {
+            QMutexLocker locker(&statsMutex);
+            if (response.value("ok").toBool())
+                completedJobs++;
+            else
+                failedJobs++;
+            totalLatencyMs += latency;
+            maxLatencyMs = std::max(maxLatencyMs, latency);
+        }
+        respond(job.client, response);
+    }
+}
+
+// Run a single job, every failure is turned into an "ok": false response
+QJsonObject SaveDaemon::process(const QJsonObject &request) {
+    QJsonObject response;
+    QString op = request.value("op").toString();
+    MemoryAccounting::Operation accounting(op);
+    try {
+        QString savePath = QFileInfo(request.value("save").toString()).absoluteFilePath();
+        if (op == "query")
+            response = querySave(savePath, request);
+        else if (op == "edit")
+            response = editSave(savePath, request);
+        else
+            throw std::runtime_error(("Unknown operation \"" + op + "\"").toStdString());
+        response.insert("ok", true);
+    } catch (std::bad_alloc const&) {
+        // e.g. a corrupted save claiming a huge size, the daemon keeps serving other saves
+        response = QJsonObject();
+        response.insert("ok", false);
+        response.insert("error", QString("Out of memory"));
+    } catch (std::exception const& e) {
+        response = QJsonObject();
+        response.insert("ok", false);
+        response.insert("error", QString(e.what()));
+    } catch (...) {
+        response = QJsonObject();
+        response.insert("ok", false);
+        response.insert("error", QString("Unknown error"));
+    }
+    response.insert("memory", accounting.report().toJson());
+    if (request.contains("id"))
+        response.insert("id", request.value("id"));
+    return response;
+}
+
+QJsonObject SaveDaemon::querySave(const QString &savePath, const QJsonObject &request) {
+    // only gamesession.xml is needed, the sidecar index lets later queries skip the rest
+    GameSession session;
+    if (!session.setContent(SaveUtil::readEntry(savePath, "gamesession.xml", true)))
+        throw std::runtime_error(("Could not read gamesession.xml from \"" + savePath + "\"").toStdString());
+
+    QJsonObject response;
+    response.insert("money", session.getMoney());
+    response.insert("submarine", session.currentSubmarine());
+    response.insert("available", QJsonArray::fromStringList(session.submarinesList(GameSession::AvailableSubmarine)));
+    response.insert("owned", QJsonArray::fromStringList(session.submarinesList(GameSession::OwnedSubmarine)));
+    // campaign map locations are only listed on request, looked up through the location index
+    if (request.contains("locations")) {
+        QJsonArray locations;
+        for (LocationIndex::Location const& location:
+             session.locations(locationFilterFromJson(request.value("locations").toObject()))) {
+            locations.push_back(locationToJson(location));
+        }
+        response.insert("locations", locations);
+    }
+    return response;
+}
+
+QJsonObject SaveDaemon::editSave(const QString &savePath, const QJsonObject &request) {
+    QTemporaryDir workspace;
+    if (!workspace.isValid())
+        throw std::runtime_error("Could not create temporary workspace");
+    SaveUtil::decompressToDirectory(savePath, workspace.path());
+    GameSession session;
+    if (!session.fromXML(workspace.filePath("gamesession.xml")))
+        throw std::runtime_error(("Could not read gamesession.xml from \"" + savePath + "\"").toStdString());
+
+    int applied = 0;
+    int locationsChanged = 0;
+    // consecutive location edits are applied together, in one pass over the campaign map
+    QVector<LocationIndex::Edit> locationEdits;
+    auto applyLocationEdits = [&]() {
+        if (locationEdits.isEmpty())
+            return;
+        int appliedEdits = 0;
+        locationsChanged += session.editLocations(locationEdits, &appliedEdits);
+        applied += appliedEdits;
+        locationEdits.clear();
+    };
+    for (QJsonValue const& value: request.value("edits").toArray()) {
+        QJsonObject edit = value.toObject();
+        QString type = edit.value("type").toString();
+        if (type == "editLocations") {
+            locationEdits.push_back(locationEditFromJson(edit));
+            continue;
+        }
+        // edits are applied in request order
+        applyLocationEdits();
+        if (type == "setMoney") {
+            qint64 amount = edit.value("amount").toVariant().toLongLong();
+            if (session.apply(GameSession::Edit::setMoney(amount)))
+                applied++;
+            continue;
+        }
+        if (type != "addSub" && type != "removeSub")
+            throw std::runtime_error(("Unknown edit type \"" + type + "\"").toStdString());
+        QString name = edit.value("name").toString();
+        // the name becomes a path in the workspace, it must not lead out of it
+        if (name.isEmpty() || name.contains('/') || name.contains('\\') || name.contains(".."))
+            throw std::runtime_error(("Invalid submarine name \"" + name + "\"").toStdString());
+        GameSession::SubmarineType subType = edit.value("owned").toBool() ?
+                    GameSession::OwnedSubmarine : GameSession::AvailableSubmarine;
+        QString subPath = workspace.filePath(name + subExt);
+        if (type == "addSub") {
+            // submarines missing from the save are taken from the library
+            if (!QFile::exists(subPath) && session.currentSubmarine() != name) {
+                SubmarineLibrary::Entry entry;
+                if (!subLibrary.find(name, entry))
+                    throw std::runtime_error(("Submarine \"" + name + "\" is not in the save or in the submarine library").toStdString());
+                if (!QFile::copy(entry.path, subPath))
+                    throw std::runtime_error(("Could not copy submarine \"" + name + "\" into the save").toStdString());
+            }
+            if (session.apply(GameSession::Edit::addSubmarine(name, subType)))
+                applied++;
+        } else {
+            if (session.apply(GameSession::Edit::removeSubmarine(name, subType)))
+                applied++;
+            if (!session.containsSubmarine(name))
+                QFile::remove(subPath);
+        }
+    }
+    applyLocationEdits();
+    session.dumpXML();
+
+    if (request.value("backup").toBool() && !SaveUtil::backupFile(savePath))
+        throw std::runtime_error(("Could not back up \"" + savePath + "\"").toStdString());
+    // the save is replaced atomically, a failed job never leaves a truncated or missing save
+    SaveUtil::compressDirectory(workspace.path(), savePath);
+    // the index is stale only once the new save is in place
+    QFile::remove(SaveIndex::indexPathFor(savePath));
+
+    QJsonObject response;
+    response.insert("applied", applied);
+    response.insert("locationsChanged", locationsChanged);
+    return response;
+}
+
+QJsonObject SaveDaemon::statsToJson() const {
+    Stats current = stats();
+    QJsonObject response;
+    response.insert("queued", current.queued);
+    response.insert("running", current.running);
+    response.insert("completed", current.completed);
+    response.insert("failed", current.failed);
+    response.insert("meanLatencyMs", current.meanLatencyMs);
+    response.insert("maxLatencyMs", current.maxLatencyMs);
+    response.insert("memoryInUse", static_cast<qint64>(MemoryAccounting::inUse()));
+    response.insert("memoryBudget", static_cast<qint64>(MemoryAccounting::budget()));
+    return response;
+}
+
+// Send response to the client from the thread that owns its socket
+void SaveDaemon::respond(const QPointer<QLocalSocket> &client, const QJsonObject &response) {
+    QByteArray line = QJsonDocument(response).toJson(QJsonDocument::Compact) + '\n';
+    QMetaObject::invokeMethod(this, [client, line]() {
+        if (client)
+            client->write(line);
+    }, Qt::QueuedConnection);
+}
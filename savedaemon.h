@@ -0,0 +1,103 @@
+#ifndef SAVEDAEMON_H
+#define SAVEDAEMON_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+#include <QString>
+#include <QThreadPool>
+
+#include <sublibrary.h>
+
+class QLocalServer;
+class QLocalSocket;
+
+/* Headless save processing service for dedicated servers
+ * Listens on a local socket for newline separated JSON jobs. Jobs for
+ * different saves run concurrently, jobs for the same save run in the
+ * order they were received. Worker threads, their zlib streams and the
+ * submarine library index stay warm between jobs.
+ *
+ * Requests:
+ *   {"id": 1, "op": "query", "save": "<path>", "locations": {"type": "outpost"}}
+ *   {"id": 2, "op": "edit", "save": "<path>", "backup": true, "edits": [
+ *       {"type": "setMoney", "amount": 5000},
+ *       {"type": "addSub", "name": "<library sub>", "owned": true},
+ *       {"type": "removeSub", "name": "<sub>", "owned": false},
+ *       {"type": "editLocations", "action": "setReputation", "value": 50,
+ *        "filter": {"type": "outpost", "center": [x, y], "radius": 500}}]}
+ *   {"id": 3, "op": "stats"}
+ * Every request is answered with one JSON line carrying the same "id"
+ * and "ok": true/false ("error" holds the message on failure). Query and
+ * edit responses also carry the "memory" report of the job (see MemoryAccounting).
+ * A query lists campaign map locations matching the optional "locations" filter.
+ * Edits are applied in request order, consecutive location edits together
+ * (see GameSession::editLocations). "applied" counts edits that changed the
+ * save, "locationsChanged" the locations they changed.
+ */
+class SaveDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats {
+        int queued = 0;        // jobs waiting for their save
+        int running = 0;       // jobs being processed
+        qint64 completed = 0;
+        qint64 failed = 0;
+        double meanLatencyMs = 0; // time from receiving a job to answering it
+        qint64 maxLatencyMs = 0;
+    };
+
+    explicit SaveDaemon(QString const& subLibraryPath, QObject* parent = nullptr);
+    ~SaveDaemon() override;
+
+    bool listen(QString const& socketName);
+    QString errorString() const;
+    Stats stats() const;
+
+    static QByteArray request(QString const& socketName, QByteArray const& json, int timeoutMsec = 60000);
+
+private slots:
+    void acceptConnection();
+    void readRequests();
+
+private:
+    struct Job {
+        QJsonObject request;
+        QPointer<QLocalSocket> client;
+        QElapsedTimer received;
+    };
+    struct SaveQueue {
+        QQueue<Job> jobs;
+        bool running = false;
+    };
+
+    void enqueue(Job const& job);
+    void drain(QString const& savePath);
+    QJsonObject process(QJsonObject const& request);
+    QJsonObject querySave(QString const& savePath, QJsonObject const& request);
+    QJsonObject editSave(QString const& savePath, QJsonObject const& request);
+    QJsonObject statsToJson() const;
+    void respond(QPointer<QLocalSocket> const& client, QJsonObject const& response);
+
+    QLocalServer* server;
+    SubmarineLibrary subLibrary;
+    QThreadPool workers;
+
+    mutable QMutex queueMutex;
+    QHash<QString, SaveQueue> queues; // per save path, keeps jobs for one save serialized
+    int queuedJobs = 0;
+    int runningJobs = 0;
+
+    mutable QMutex statsMutex;
+    qint64 completedJobs = 0;
+    qint64 failedJobs = 0;
+    qint64 totalLatencyMs = 0;
+    qint64 maxLatencyMs = 0;
+};
+
+#endif // SAVEDAEMON_H
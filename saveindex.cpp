@@ -0,0 +1,360 @@
+#include "saveindex.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <gzip-cpp/config.hpp>
+#include <zlib.h>
+
+static const quint32 indexMagic = 0x42534958; // "BSIX"
+static const quint32 indexVersion = 1;
+static const unsigned windowSize = 32768; // largest deflate distance
+static const unsigned inputChunk = 64 * 1024;
+static const quint64 maxDeflateRatio = 1032; // no deflate stream expands more than this
+static const quint64 maxReserve = 256 * 1024 * 1024; // larger archives grow as they are inflated
+
+// convert bytes to uint32 assuming little endian byte ordering
+static quint32 toUInt32(const char* bytes) {
+    return  (static_cast<quint32>(static_cast<unsigned char>(bytes[3])) << 24) |
+            (static_cast<quint32>(static_cast<unsigned char>(bytes[2])) << 16) |
+            (static_cast<quint32>(static_cast<unsigned char>(bytes[1])) << 8) |
+            (static_cast<quint32>(static_cast<unsigned char>(bytes[0])));
+}
+
+namespace {
+
+// Finds archive entry headers in uncompressed data as it is inflated
+class EntryScanner
+{
+public:
+    explicit EntryScanner(QVector<SaveIndex::Entry>& entries) : entries(entries) {}
+    void feed(const char* data, size_t size, quint64 offset);
+
+private:
+    size_t headerSize() const;
+
+    QVector<SaveIndex::Entry>& entries;
+    quint64 nextHeader = 0; // uncompressed offset of the next entry header
+    QByteArray header;      // bytes of that header seen so far
+    bool stopped = false;
+};
+
+// @returns size_t: size of the header being read, as far as it is known
+size_t EntryScanner::headerSize() const {
+    if (header.size() < 4)
+        return 4;
+    size_t nameLen = toUInt32(header.constData());
+    return sizeof(qint32) + nameLen * sizeof(char16_t) + sizeof(qint32);
+}
+
+/* @param data: newly inflated data
+ * @param size: length of data
+ * @param offset: uncompressed offset of data
+ */
+void EntryScanner::feed(const char* data, size_t size, quint64 offset) {
+    while (size > 0 && !stopped) {
+        if (offset < nextHeader) {
+            // entry contents
+            size_t skip = static_cast<size_t>(std::min<quint64>(size, nextHeader - offset));
+            data += skip;
+            size -= skip;
+            offset += skip;
+            continue;
+        }
+        size_t take = std::min(size, headerSize() - static_cast<size_t>(header.size()));
+        header.append(data, static_cast<int>(take));
+        data += take;
+        size -= take;
+        offset += take;
+        if (header.size() == 4 && toUInt32(header.constData()) > 255) {
+            stopped = true; // same limit as SaveUtil::extractFile, data is corrupted
+            return;
+        }
+        if (header.size() > 4 && static_cast<size_t>(header.size()) == headerSize()) {
+            size_t nameLen = toUInt32(header.constData());
+            QString name;
+            name.reserve(static_cast<int>(nameLen));
+            for (size_t i = 0; i < nameLen; i++) {
+                const char* ch = header.constData() + sizeof(qint32) + i * sizeof(char16_t);
+                name.append(QChar(static_cast<char16_t>(
+                        (static_cast<unsigned char>(ch[1]) << 8) | static_cast<unsigned char>(ch[0]))));
+            }
+            quint32 contentLen = toUInt32(header.constData() + header.size() - sizeof(qint32));
+            quint64 contentOffset = nextHeader + static_cast<quint64>(header.size());
+            entries.push_back(SaveIndex::Entry{name, nextHeader, contentOffset, contentLen});
+            nextHeader = contentOffset + contentLen;
+            header.clear();
+        }
+    }
+}
+
+void initStream(z_stream& strm) {
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+}
+
+} // namespace
+
+/* Inflate the whole save and build the index
+ * @param span: minimum distance between access points in uncompressed bytes
+ * @param data: when set, receives the inflated archive
+ * @param dataCharge: when set, data stays charged to it after returning
+ * @throws std::runtime_error: when the save can't be read, is corrupted or data would exceed the memory budget
+ */
+void SaveIndex::build(const QString &savePath, quint64 span, std::string* data, MemoryAccounting::Buffer* dataCharge) {
+    QFile file(savePath);
+    if (!file.open(QFile::ReadOnly))
+        throw std::runtime_error(("Could not open file \"" + savePath + "\" for reading").toStdString());
+    QFileInfo info(file);
+    points.clear();
+    entryList.clear();
+    EntryScanner scanner(entryList);
+
+    if (data) {
+        // gzip trailer holds the uncompressed size (mod 2^32), the file is untrusted
+        // so it's only a hint bounded by what the compressed size allows
+        char trailer[4];
+        if (file.size() > 4 && file.seek(file.size() - 4) && file.read(trailer, 4) == 4) {
+            quint64 hint = std::min({static_cast<quint64>(toUInt32(trailer)),
+                                     static_cast<quint64>(file.size()) * maxDeflateRatio, maxReserve});
+            MemoryAccounting::StageScope stage(MemoryAccounting::Inflate);
+            if (dataCharge)
+                dataCharge->resize(static_cast<size_t>(hint));
+            data->reserve(static_cast<size_t>(hint));
+        }
+        file.seek(0);
+    }
+
+    z_stream strm;
+    initStream(strm);
+    if (inflateInit2(&strm, 15 + 32) != Z_OK)
+        throw std::runtime_error("inflate init failed");
+
+    QByteArray input(static_cast<int>(inputChunk), Qt::Uninitialized);
+    QByteArray window(static_cast<int>(windowSize), '\0'); // circular buffer of recent output
+    quint64 totalIn = 0;
+    quint64 totalOut = 0;
+    quint64 last = 0; // output offset of the last access point
+    strm.avail_out = 0;
+    int ret = Z_OK;
+    do {
+        qint64 got = file.read(input.data(), inputChunk);
+        if (got <= 0) {
+            inflateEnd(&strm);
+            throw std::runtime_error("gzip error: unexpected end of file");
+        }
+        strm.avail_in = static_cast<unsigned int>(got);
+        strm.next_in = reinterpret_cast<z_const Bytef*>(input.constData());
+        do {
+            if (strm.avail_out == 0) {
+                strm.avail_out = windowSize;
+                strm.next_out = reinterpret_cast<Bytef*>(window.data());
+            }
+            Bytef* produceStart = strm.next_out;
+            totalIn += strm.avail_in;
+            totalOut += strm.avail_out;
+            // stop at block boundaries, access points can only be placed there
+            ret = inflate(&strm, Z_BLOCK);
+            totalIn -= strm.avail_in;
+            totalOut -= strm.avail_out;
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+                std::string message = strm.msg ? strm.msg : "inflate failed";
+                inflateEnd(&strm);
+                throw std::runtime_error("gzip error: " + message);
+            }
+            size_t produced = static_cast<size_t>(strm.next_out - produceStart);
+            const char* producedData = reinterpret_cast<const char*>(produceStart);
+            scanner.feed(producedData, produced, totalOut - produced);
+            if (data) {
+                // charged before growing, so the budget fails the job instead of the allocation
+                if (dataCharge && data->size() + produced > dataCharge->size()) {
+                    MemoryAccounting::StageScope stage(MemoryAccounting::Inflate);
+                    try {
+                        dataCharge->resize(std::max(data->size() + produced, 2 * data->size()));
+                    } catch (std::runtime_error const&) {
+                        inflateEnd(&strm);
+                        throw;
+                    }
+                }
+                data->append(producedData, produced);
+            }
+            if (ret == Z_STREAM_END)
+                break;
+
+            // bit 7: end of block header, bit 6: last block
+            bool blockBoundary = (strm.data_type & 128) && !(strm.data_type & 64);
+            if (blockBoundary && (points.isEmpty() || totalOut - last > span)) {
+                AccessPoint point{totalOut, totalIn, strm.data_type & 7, QByteArray(static_cast<int>(windowSize), '\0')};
+                unsigned left = strm.avail_out; // oldest data starts at window + windowSize - left
+                if (left)
+                    memcpy(point.window.data(), window.constData() + windowSize - left, left);
+                if (left < windowSize)
+                    memcpy(point.window.data() + left, window.constData(), windowSize - left);
+                points.push_back(point);
+                last = totalOut;
+            }
+        } while (strm.avail_in != 0);
+    } while (ret != Z_STREAM_END);
+    inflateEnd(&strm);
+
+    // drop a trailing entry cut short, SaveUtil ignores those too
+    while (!entryList.isEmpty() &&
+           entryList.last().contentOffset + entryList.last().contentLength > totalOut) {
+        entryList.removeLast();
+    }
+    saveSize = info.size();
+    saveModified = info.lastModified().toMSecsSinceEpoch();
+}
+
+// Write index to a sidecar file, windows are stored compressed
+bool SaveIndex::save(const QString &indexPath) const {
+    QSaveFile file(indexPath);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out << indexMagic << indexVersion << saveSize << saveModified;
+    out << static_cast<quint32>(points.size());
+    for (AccessPoint const& point: points) {
+        out << point.outOffset << point.inOffset << static_cast<qint32>(point.bits) << qCompress(point.window);
+    }
+    out << static_cast<quint32>(entryList.size());
+    for (Entry const& entry: entryList) {
+        out << entry.name << entry.headerOffset << entry.contentOffset << entry.contentLength;
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+// @returns bool: false when there is no valid index at indexPath
+bool SaveIndex::load(const QString &indexPath) {
+    QFile file(indexPath);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version;
+    if (magic != indexMagic || version != indexVersion)
+        return false;
+    in >> saveSize >> saveModified;
+
+    QVector<AccessPoint> loadedPoints;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        AccessPoint point;
+        qint32 bits;
+        QByteArray window;
+        in >> point.outOffset >> point.inOffset >> bits >> window;
+        point.bits = bits;
+        point.window = qUncompress(window);
+        if (point.window.size() != static_cast<int>(windowSize) || bits < 0 || bits > 7)
+            return false;
+        loadedPoints.push_back(point);
+    }
+    QVector<Entry> loadedEntries;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        Entry entry;
+        in >> entry.name >> entry.headerOffset >> entry.contentOffset >> entry.contentLength;
+        loadedEntries.push_back(entry);
+    }
+    if (in.status() != QDataStream::Ok || loadedPoints.isEmpty())
+        return false;
+    points.swap(loadedPoints);
+    entryList.swap(loadedEntries);
+    return true;
+}
+
+// @returns bool: true if the index was built from the current version of the save
+bool SaveIndex::matches(const QString &savePath) const {
+    QFileInfo info(savePath);
+    return info.exists() && info.size() == saveSize &&
+            info.lastModified().toMSecsSinceEpoch() == saveModified;
+}
+
+const SaveIndex::Entry* SaveIndex::find(const QString &name) const {
+    for (Entry const& entry: entryList) {
+        if (entry.name == name)
+            return &entry;
+    }
+    return nullptr;
+}
+
+/* Read a single archive entry by inflating from the nearest access point
+ * @throws std::runtime_error: when the entry doesn't exist or the save is corrupted
+ */
+QByteArray SaveIndex::readEntry(const QString &savePath, const QString &name) const {
+    Entry const* entry = find(name);
+    if (entry == nullptr)
+        throw std::runtime_error(("Save \"" + savePath + "\" has no file \"" + name + "\"").toStdString());
+    // last access point at or before the entry contents
+    auto next = std::upper_bound(points.begin(), points.end(), entry->contentOffset,
+                                 [](quint64 offset, AccessPoint const& point) { return offset < point.outOffset; });
+    if (next == points.begin())
+        throw std::runtime_error("Save index has no access point before \"" + name.toStdString() + "\"");
+    AccessPoint const& point = *(next - 1);
+
+    QFile file(savePath);
+    if (!file.open(QFile::ReadOnly) || !file.seek(static_cast<qint64>(point.inOffset) - (point.bits ? 1 : 0)))
+        throw std::runtime_error(("Could not open file \"" + savePath + "\" for reading").toStdString());
+
+    z_stream strm;
+    initStream(strm);
+    if (inflateInit2(&strm, -15) != Z_OK) // raw deflate, we start in the middle of the stream
+        throw std::runtime_error("inflate init failed");
+    if (point.bits) {
+        char partial;
+        file.getChar(&partial);
+        inflatePrime(&strm, point.bits, static_cast<unsigned char>(partial) >> (8 - point.bits));
+    }
+    inflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(point.window.constData()), windowSize);
+
+    QByteArray content(static_cast<int>(entry->contentLength), Qt::Uninitialized);
+    QByteArray discard(static_cast<int>(windowSize), Qt::Uninitialized);
+    QByteArray input(static_cast<int>(inputChunk), Qt::Uninitialized);
+    quint64 skip = entry->contentOffset - point.outOffset;
+    quint32 produced = 0;
+    while (produced < entry->contentLength) {
+        if (strm.avail_in == 0) {
+            qint64 got = file.read(input.data(), inputChunk);
+            if (got <= 0)
+                break;
+            strm.avail_in = static_cast<unsigned int>(got);
+            strm.next_in = reinterpret_cast<z_const Bytef*>(input.constData());
+        }
+        if (skip > 0) {
+            strm.next_out = reinterpret_cast<Bytef*>(discard.data());
+            strm.avail_out = static_cast<unsigned int>(std::min<quint64>(skip, windowSize));
+        } else {
+            strm.next_out = reinterpret_cast<Bytef*>(content.data() + produced);
+            strm.avail_out = entry->contentLength - produced;
+        }
+        unsigned before = strm.avail_out;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+            break;
+        unsigned got = before - strm.avail_out;
+        if (skip > 0)
+            skip -= got;
+        else
+            produced += got;
+        if (ret == Z_STREAM_END)
+            break;
+    }
+    inflateEnd(&strm);
+    if (produced < entry->contentLength)
+        throw std::runtime_error(("Could not read \"" + name + "\" from \"" + savePath + "\" - the file may be corrupted").toStdString());
+    return content;
+}
+
+QString SaveIndex::indexPathFor(const QString &savePath) {
+    return savePath + ".idx";
+}
@@ -0,0 +1,57 @@
+#ifndef SAVEINDEX_H
+#define SAVEINDEX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <string>
+
+#include <memoryaccounting.h>
+
+/* Random access index of a compressed save archive (zran style)
+ * Built during one full inflate, it stores the 32 KB inflate window at
+ * access points spaced every span bytes of uncompressed data, and the
+ * uncompressed offset of every archive entry. A single entry can then be
+ * read by inflating from the nearest access point before it.
+ * The index is kept in a sidecar file next to the save (<save>.idx).
+ */
+class SaveIndex
+{
+public:
+    struct AccessPoint {
+        quint64 outOffset; // uncompressed offset
+        quint64 inOffset;  // offset of the first full compressed byte
+        int bits;          // bits of the byte before inOffset still to be used
+        QByteArray window; // uncompressed data preceding outOffset
+    };
+
+    struct Entry {
+        QString name;
+        quint64 headerOffset;  // uncompressed offset of the entry header
+        quint64 contentOffset; // uncompressed offset of the file contents
+        quint32 contentLength;
+    };
+
+    static constexpr quint64 defaultSpan = 1024 * 1024;
+
+    void build(QString const& savePath, quint64 span = defaultSpan, std::string* data = nullptr,
+               MemoryAccounting::Buffer* dataCharge = nullptr);
+    bool save(QString const& indexPath) const;
+    bool load(QString const& indexPath);
+    bool matches(QString const& savePath) const;
+
+    Entry const* find(QString const& name) const;
+    QVector<Entry> const& entries() const { return entryList; }
+    QByteArray readEntry(QString const& savePath, QString const& name) const;
+
+    static QString indexPathFor(QString const& savePath);
+
+private:
+    qint64 saveSize = -1;
+    qint64 saveModified = 0; // msecs since epoch
+    QVector<AccessPoint> points;
+    QVector<Entry> entryList;
+};
+
+#endif // SAVEINDEX_H
@@ -1,12 +1,15 @@
 #include "saveutil.h"
 
 #include <cstring>
+#include <limits>
 
 #include <QByteArray>
 #include <QDir>
+#include <QSaveFile>
 
-#include <gzip-cpp/decompress.hpp>
-#include <gzip-cpp/compress.hpp>
+#include <memoryaccounting.h>
+#include <saveindex.h>
+#include <zcodec.h>
 
 // convert bytes to int32 assuming little endian byte ordering
 int32_t SaveUtil::toInt32(const char* bytes, size_t offset) {
@@ -56,16 +59,10 @@ bool SaveUtil::checkBufferOverflow(size_t offset, size_t bufSize, size_t readSiz
 
 // Decompress a gzipped file into a directory, same method as in:
 // https://github.com/Regalis11/Barotrauma/blob/0002ad2c501a1a8df323b52edfc82a78d0afc6bc/Barotrauma/BarotraumaShared/SharedSource/Utils/SaveUtil.cs
-void SaveUtil::decompressToDirectory(QString const& filePath, QString const& destDirPath) {
-    QFile compressedFile(filePath);
-    compressedFile.open(QFile::ReadOnly);
-    std::string data;
-    try {
-        data = gzip::decompress(compressedFile.readAll().data(), static_cast<size_t>(compressedFile.size()));
-    } catch(std::runtime_error const& e) {
-        // rethrow exception
-        throw std::runtime_error(std::string("gzip error: ") + e.what());
-    }
+// @param writeIndex: also write a sidecar index (see SaveIndex) during the same inflate
+void SaveUtil::decompressToDirectory(QString const& filePath, QString const& destDirPath, bool writeIndex) {
+    MemoryAccounting::Buffer dataCharge;
+    std::string data = inflateArchive(filePath, writeIndex, dataCharge);
 
     // create destination dir
     QDir outDir(destDirPath);
@@ -73,31 +70,105 @@ void SaveUtil::decompressToDirectory(QString const& filePath, QString const& des
         outDir.removeRecursively();
     outDir.mkpath(".");
 
+    // write all extracted files in a single batch
+    BatchIO::writeFiles(parseArchive(destDirPath, data));
+}
+
+/* Read all files of a save archive into memory
+ * @param visit: called with the name and contents of every file, contents are valid during the call only
+ * @throws std::runtime_error: when the archive is corrupted
+ */
+void SaveUtil::readArchive(QString const& filePath, EntryVisitor const& visit) {
+    MemoryAccounting::Buffer dataCharge;
+    std::string data = inflateArchive(filePath, false, dataCharge);
+    for (BatchIO::WriteRequest const& entry: parseArchive(QString(), data)) {
+        visit(entry.path, entry.data, entry.size);
+    }
+}
+
+/* Inflate a whole save archive
+ * @param dataCharge: inflated data stays charged to it
+ */
+std::string SaveUtil::inflateArchive(QString const& filePath, bool writeIndex, MemoryAccounting::Buffer& dataCharge) {
+    std::string data;
+    if (writeIndex) {
+        SaveIndex index;
+        index.build(filePath, SaveIndex::defaultSpan, &data, &dataCharge);
+        index.save(SaveIndex::indexPathFor(filePath));
+    } else {
+        QFile compressedFile(filePath);
+        compressedFile.open(QFile::ReadOnly);
+        try {
+            // compressed data is dropped before files are extracted
+            MemoryAccounting::StageScope stage(MemoryAccounting::ReadArchive);
+            MemoryAccounting::Buffer compressedCharge(static_cast<size_t>(compressedFile.size()));
+            QByteArray compressed = compressedFile.readAll();
+            data = ZCodec::local().decompress(compressed.constData(), static_cast<size_t>(compressed.size()), &dataCharge);
+        } catch(std::runtime_error const& e) {
+            // rethrow exception
+            throw std::runtime_error(std::string("gzip error: ") + e.what());
+        }
+    }
+    return data;
+}
+
+/* Split inflated archive into files
+ * @param dir: directory the files are written to, empty for bare file names
+ * @returns std::vector<BatchIO::WriteRequest>: files, contents point into data
+ */
+std::vector<BatchIO::WriteRequest> SaveUtil::parseArchive(QString const& dir, std::string const& data) {
     size_t progress = 0; // offset from the beginning of file
     bool moreData = true; // true if more files could be extracted
     int index = 1; // index of file being processed
+    std::vector<BatchIO::WriteRequest> writes;
     while (moreData) {
         try {
-            moreData = extractFile(destDirPath, data.c_str(), progress, data.size());
+            moreData = extractFile(dir, data.c_str(), progress, data.size(), writes);
         } catch(std::runtime_error const& e) {
             QString errorMsg = QString("File ID: %1 processing error: ").arg(index);
             throw std::runtime_error((errorMsg+e.what()).toStdString());
         }
         index++;
     }
+    return writes;
 }
 
-/* @param dir: directory where the file should be extracted
+/* Read a single file from a save archive
+ * When the sidecar index is up to date only the part of the archive around
+ * the file is inflated, otherwise the whole archive is.
+ * @param createIndex: write the sidecar index when it's missing or outdated
+ * @throws std::runtime_error: when the file is not in the archive or the archive is corrupted
+ */
+QByteArray SaveUtil::readEntry(QString const& filePath, QString const& entryName, bool createIndex) {
+    SaveIndex index;
+    QString indexPath = SaveIndex::indexPathFor(filePath);
+    if (index.load(indexPath) && index.matches(filePath))
+        return index.readEntry(filePath, entryName);
+
+    std::string data;
+    MemoryAccounting::Buffer dataCharge;
+    index.build(filePath, SaveIndex::defaultSpan, &data, &dataCharge);
+    if (createIndex)
+        index.save(indexPath);
+    SaveIndex::Entry const* entry = index.find(entryName);
+    if (entry == nullptr)
+        throw std::runtime_error(("Save \"" + filePath + "\" has no file \"" + entryName + "\"").toStdString());
+    return QByteArray(data.data() + entry->contentOffset, static_cast<int>(entry->contentLength));
+}
+
+/* @param dir: directory where the file should be extracted, empty for a bare file name
  * @param data: pointer to the uncompressed data buffer
  * @param offset: reference to the current offset value in the data (will be modified)
  * @param size: the size of the data buffer
+ * @param writes: the file write is queued here, data must outlive the batch
  * @returns bool: is there more data left to read?
  *
  * extract file from the decompressed data
  * method for extraction is specified in decompressFile method:
  * https://github.com/Regalis11/Barotrauma/blob/0002ad2c501a1a8df323b52edfc82a78d0afc6bc/Barotrauma/BarotraumaShared/SharedSource/Utils/SaveUtil.cs
  */
-bool SaveUtil::extractFile(const QString& dir, const char* data, size_t& offset, size_t size) {
+bool SaveUtil::extractFile(const QString& dir, const char* data, size_t& offset, size_t size,
+                           std::vector<BatchIO::WriteRequest>& writes) {
     //// Extract file name
     if (checkBufferOverflow(offset, size, sizeof(int32_t))) // [result] < 0 || [result] < 4
         return false;
@@ -129,13 +200,10 @@ bool SaveUtil::extractFile(const QString& dir, const char* data, size_t& offset,
     const char * contentPtr = &data[offset];
     offset += contentLen * sizeof(char); // read the entire content
 
-    QString extractedFilePath(dir + QDir::separator() + QString::fromUtf16(filename.data()));
-    QFile outFile(extractedFilePath);
-    outFile.open(QFile::WriteOnly | QFile::Truncate);
-    qint64 written = outFile.write(contentPtr, static_cast<qint64>(contentLen));
-    if (written != static_cast<qint64>(contentLen))
-        throw std::runtime_error("Write failed (not enough data written) when saving \"" + extractedFilePath.toStdString() + "\"");
-    outFile.close();
+    QString extractedFilePath = QString::fromStdU16String(filename);
+    if (!dir.isEmpty())
+        extractedFilePath = dir + QDir::separator() + extractedFilePath;
+    writes.push_back(BatchIO::WriteRequest{extractedFilePath, contentPtr, contentLen});
 
     return true;
 }
@@ -146,46 +214,107 @@ bool SaveUtil::extractFile(const QString& dir, const char* data, size_t& offset,
  */
 void SaveUtil::compressDirectory(QString const& inDirPath, QString const& outFilePath) {
     QDir inDir(inDirPath);
-    QFileInfoList inFiles = inDir.entryInfoList(QDir::Files);
-    if (inFiles.empty())
+    QStringList filePaths;
+    for (QFileInfo const& inFileInfo: inDir.entryInfoList(QDir::Files)) {
+        filePaths.push_back(inFileInfo.absoluteFilePath());
+    }
+    if (filePaths.empty())
         throw std::runtime_error(("Could not compress directory \"" + inDirPath + "\" - directory is empty").toStdString());
-    QFile outFile(outFilePath);
-    outFile.open(QFile::Truncate | QFile::WriteOnly);
+    compressFiles(filePaths, QVector<MemoryFile>(), outFilePath);
+}
+
+/* Compress files into a save archive
+ * @param filePaths: files read from disk
+ * @param memoryFiles: files stored from memory, written after files from disk
+ * @param outFilePath: where the file should be written, an existing file is replaced atomically
+ * @throws std::runtime_error: if the archive could not be written, the old file is left untouched
+ */
+void SaveUtil::compressFiles(QStringList const& filePaths, QVector<MemoryFile> const& memoryFiles,
+                             QString const& outFilePath) {
+    MemoryAccounting::StageScope stage(MemoryAccounting::BuildArchive);
+    // read all files in a single batch
+    std::vector<BatchIO::ReadRequest> reads;
+    reads.reserve(static_cast<size_t>(filePaths.size()));
+    size_t inputSize = 0;
+    for (QString const& filePath: filePaths) {
+        reads.push_back(BatchIO::ReadRequest{filePath, AlignedBuffer()});
+        inputSize += static_cast<size_t>(QFileInfo(filePath).size());
+    }
+    MemoryAccounting::Buffer inputCharge(inputSize);
+    try {
+        BatchIO::readFiles(reads);
+    } catch (std::runtime_error const& e) {
+        throw std::runtime_error(std::string(e.what()) + ". Save aborted!");
+    }
+
     QByteArray buffer;
-    buffer.reserve(10000000); // 1MB should cover small save files
-    for (QFileInfo const& inFileInfo: inFiles) {
-        compressFile(inFileInfo.absoluteFilePath(), buffer);
+    size_t totalSize = 0;
+    for (BatchIO::ReadRequest const& read: reads) {
+        totalSize += compressedEntrySize(QFileInfo(read.path).fileName(), read.buffer.size());
     }
-    std::string compressedData = gzip::compress(buffer.data(), static_cast<size_t>(buffer.size()));
-    outFile.write(compressedData.data(), static_cast<qint64>(compressedData.size()));
-//    outFile.write(buffer.data(), buffer.size());
-}
+    for (MemoryFile const& memoryFile: memoryFiles) {
+        totalSize += compressedEntrySize(memoryFile.name, static_cast<size_t>(memoryFile.content.size()));
+    }
+    // the archive is built in a QByteArray, which is limited to INT_MAX bytes
+    if (totalSize > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::runtime_error("Save would be larger than 2 GB. Save aborted!");
+    MemoryAccounting::Buffer bufferCharge(totalSize);
+    buffer.reserve(static_cast<int>(totalSize));
+    for (BatchIO::ReadRequest const& read: reads) {
+        compressFile(QFileInfo(read.path).fileName(), read.buffer.data(), read.buffer.size(), buffer);
+    }
+    for (MemoryFile const& memoryFile: memoryFiles) {
+        compressFile(memoryFile.name, memoryFile.content.constData(),
+                     static_cast<size_t>(memoryFile.content.size()), buffer);
+    }
+    // file contents are in the archive buffer now
+    reads.clear();
+    inputCharge.resize(0);
 
-void SaveUtil::compressFile(QString const& inFilePath, QByteArray& buffer) {
-    QFile inFile(inFilePath);
-    QFileInfo inFileInfo(inFile);
-    if (!inFile.open(QFile::ReadOnly)) {
-        throw std::runtime_error(("Could not open file \"" + inFilePath + "\" for reading. Save aborted!").toStdString());
+    MemoryAccounting::Buffer compressedCharge;
+    std::string compressedData = ZCodec::local().compress(buffer.data(), static_cast<size_t>(buffer.size()),
+                                                          Z_DEFAULT_COMPRESSION, &compressedCharge);
+    // the old file stays intact until the new one is complete, it may be the base of an edit journal
+    QSaveFile outFile(outFilePath);
+    if (!outFile.open(QFile::WriteOnly))
+        throw std::runtime_error(("Could not open file \"" + outFilePath + "\" for writing. Save aborted!").toStdString());
+    if (outFile.write(compressedData.data(), static_cast<qint64>(compressedData.size())) !=
+            static_cast<qint64>(compressedData.size()) || !outFile.commit()) {
+        throw std::runtime_error(("Could not write file \"" + outFilePath + "\". Save aborted!").toStdString());
     }
+}
 
+/* Append a single file entry to the uncompressed archive buffer
+ * @param fileName: name of the file stored in the archive
+ * @param content: file contents
+ * @param contentLen: length of the file contents
+ * @param buffer: archive buffer
+ */
+void SaveUtil::compressFile(QString const& fileName, const char* content, size_t contentLen, QByteArray& buffer) {
     //// write file name
-    std::u16string fileName = inFileInfo.fileName().toStdU16String();
-    int32_t nameLen = static_cast<int32_t>(fileName.length());
+    std::u16string name = fileName.toStdU16String();
+    int32_t nameLen = static_cast<int32_t>(name.length());
     // write file name length
     appendInt32(nameLen, buffer);
     // write file name characters
-    for (unsigned i = 0; i < fileName.size(); i++) {
-        appendChar16(fileName[i], buffer);
+    for (unsigned i = 0; i < name.size(); i++) {
+        appendChar16(name[i], buffer);
     }
 
     //// write file contents
-    int32_t contentLen = static_cast<int32_t>(inFileInfo.size());
     // write file content length
-    appendInt32(contentLen, buffer);
-    buffer.append(inFile.readAll());
+    appendInt32(static_cast<int32_t>(contentLen), buffer);
+    buffer.append(content, static_cast<int>(contentLen));
+    MemoryAccounting::copied(contentLen);
+}
+
+// @returns size_t: number of bytes compressFile appends for the given entry
+size_t SaveUtil::compressedEntrySize(QString const& fileName, size_t contentLen) {
+    return sizeof(int32_t) + static_cast<size_t>(fileName.size()) * sizeof(char16_t) + sizeof(int32_t) + contentLen;
 }
 
 // Create backup of a provided file by appending .bakx to its name, "x" is an incrementing integer
+// The file is copied, so it stays in place until it's replaced.
 bool SaveUtil::backupFile(QString const& filePath, unsigned backups_limit) {
     QFile sourceFile(filePath);
     if (!sourceFile.exists())
@@ -198,6 +327,6 @@ bool SaveUtil::backupFile(QString const& filePath, unsigned backups_limit) {
             return false;
         QString fullExt = backupExt + QString::number(i);
         if (!QFile::exists(filePath+fullExt))
-            return sourceFile.rename(sourceFile.fileName() + fullExt);
+            return sourceFile.copy(sourceFile.fileName() + fullExt);
     }
 }
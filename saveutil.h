@@ -4,9 +4,17 @@
 #include <QByteArray>
 #include <QFile>
 #include <QString>
+#include <QStringList>
+#include <QVector>
 
 #include <cinttypes>
+#include <functional>
 #include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <batchio.h>
+#include <memoryaccounting.h>
 
 class SaveUtil
 {
@@ -18,14 +26,29 @@ private:
     static void appendInt32(int32_t in, QByteArray& buffer);
     static void appendChar16(char16_t in, QByteArray& buffer);
     static bool checkBufferOverflow(size_t offset, size_t bufSize, size_t readSize);
+    static std::string inflateArchive(QString const& filePath, bool writeIndex, MemoryAccounting::Buffer& dataCharge);
+    static std::vector<BatchIO::WriteRequest> parseArchive(QString const& dir, std::string const& data);
 
 public:
+    // file stored in the archive straight from memory
+    struct MemoryFile {
+        QString name;
+        QByteArray content;
+    };
+    using EntryVisitor = std::function<void(QString const& fileName, const char* content, size_t size)>;
+
     SaveUtil() = delete;
     // compression stuff
-    static void decompressToDirectory(QString const& filePath, QString const& destDirPath);
-    static bool extractFile(const QString& dir, const char* data, size_t& offset, size_t size);
+    static void decompressToDirectory(QString const& filePath, QString const& destDirPath, bool writeIndex = false);
+    static QByteArray readEntry(QString const& filePath, QString const& entryName, bool createIndex = false);
+    static void readArchive(QString const& filePath, EntryVisitor const& visit);
+    static bool extractFile(const QString& dir, const char* data, size_t& offset, size_t size,
+                            std::vector<BatchIO::WriteRequest>& writes);
     static void compressDirectory(QString const& inDirPath, QString const& outFilePath);
-    static void compressFile(QString const& inFilePath, QByteArray& buffer);
+    static void compressFiles(QStringList const& filePaths, QVector<MemoryFile> const& memoryFiles,
+                              QString const& outFilePath);
+    static void compressFile(QString const& fileName, const char* content, size_t contentLen, QByteArray& buffer);
+    static size_t compressedEntrySize(QString const& fileName, size_t contentLen);
     // addtitional management options
     static bool backupFile(QString const& filePath, unsigned backups_limit = 100);
 };
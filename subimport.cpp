@@ -0,0 +1,116 @@
+#include "subimport.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <gzip-cpp/config.hpp>
+#include <zlib.h>
+
+static const unsigned inflateChunk = 16 * 1024;
+static const int maxHeaderSize = 1024 * 1024; // root start tag must end before this much XML
+static const QByteArray submarineRootName = "submarine";
+
+namespace {
+
+// maps file paths to results, QtConcurrent needs result_type
+struct Loader {
+    typedef SubmarineImport::Result result_type;
+    QSet<QByteArray> knownHashes; // copy, the caller doesn't wait for the results
+
+    SubmarineImport::Result operator()(QString const& filePath) const {
+        return SubmarineImport::loadFile(filePath, knownHashes);
+    }
+};
+
+// @returns QByteArray: name of the root element, empty while its start tag is not complete
+QByteArray rootElementName(QByteArray const& xml) {
+    for (int i = xml.indexOf('<'); i >= 0 && i + 1 < xml.size(); i = xml.indexOf('<', i + 1)) {
+        char next = xml.at(i + 1);
+        if (next == '?' || next == '!')
+            continue;
+        int end = i + 1;
+        while (end < xml.size() && !QChar::isSpace(static_cast<uchar>(xml.at(end))) &&
+               xml.at(end) != '>' && xml.at(end) != '/')
+            end++;
+        if (end == xml.size())
+            return QByteArray();
+        return xml.mid(i + 1, end - i - 1);
+    }
+    return QByteArray();
+}
+
+} // namespace
+
+/* Read, validate and hash a single .sub file (runs on a worker thread)
+ * @param knownHashes: contents that don't need to be imported again
+ */
+SubmarineImport::Result SubmarineImport::loadFile(const QString &filePath, const QSet<QByteArray> &knownHashes) {
+    Result result;
+    result.fileName = QFileInfo(filePath).fileName();
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly)) {
+        result.error = QString("Could not open file for reading");
+        return result;
+    }
+    QByteArray data = file.readAll();
+    if (!isSubmarine(data.constData(), static_cast<size_t>(data.size()))) {
+        result.error = QString("Not a compressed submarine file");
+        return result;
+    }
+    result.hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    if (knownHashes.contains(result.hash)) {
+        result.duplicate = true;
+        return result;
+    }
+    result.payload = PayloadStore::shared().intern(data, result.hash);
+    return result;
+}
+
+/* Load all .sub files of a directory in parallel
+ * @returns QFuture<Result>: one result per file, ordered by file name
+ */
+QFuture<SubmarineImport::Result> SubmarineImport::loadDirectory(const QString &dirPath, const QSet<QByteArray> &knownHashes) {
+    QStringList filePaths;
+    for (QFileInfo const& info: QDir(dirPath).entryInfoList({"*.sub"}, QDir::Files, QDir::Name)) {
+        filePaths.push_back(info.absoluteFilePath());
+    }
+    return QtConcurrent::mapped(filePaths, Loader{knownHashes});
+}
+
+/* Check gzip header and that the root element is <Submarine>
+ * Only the beginning of the file is inflated.
+ */
+bool SubmarineImport::isSubmarine(const char* data, size_t size) {
+    if (size < 18 || static_cast<uchar>(data[0]) != 0x1f || static_cast<uchar>(data[1]) != 0x8b)
+        return false;
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.avail_in = 0;
+    stream.next_in = Z_NULL;
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        return false;
+    stream.next_in = reinterpret_cast<z_const Bytef*>(data);
+    stream.avail_in = static_cast<unsigned int>(size);
+
+    QByteArray xml;
+    QByteArray rootName;
+    int ret = Z_OK;
+    while (ret == Z_OK && rootName.isEmpty() && xml.size() < maxHeaderSize) {
+        int oldSize = xml.size();
+        xml.resize(oldSize + static_cast<int>(inflateChunk));
+        stream.next_out = reinterpret_cast<Bytef*>(xml.data() + oldSize);
+        stream.avail_out = inflateChunk;
+        ret = inflate(&stream, Z_NO_FLUSH);
+        xml.resize(oldSize + static_cast<int>(inflateChunk - stream.avail_out));
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        rootName = rootElementName(xml);
+    }
+    inflateEnd(&stream);
+    return rootName.toLower() == submarineRootName;
+}
@@ -0,0 +1,36 @@
+#ifndef SUBIMPORT_H
+#define SUBIMPORT_H
+
+#include <QByteArray>
+#include <QFuture>
+#include <QSet>
+#include <QString>
+
+#include <cstddef>
+
+#include <payloadstore.h>
+
+/* Import of .sub files in bulk
+ * Files are read, validated and hashed on the QtConcurrent thread pool.
+ * Files whose contents are already known are skipped before they are
+ * added to the PayloadStore.
+ */
+class SubmarineImport
+{
+public:
+    struct Result {
+        QString fileName;
+        QByteArray hash;        // SHA-1 of the file, hex encoded, empty when it couldn't be read
+        PayloadRef payload;     // null for duplicates and invalid files
+        bool duplicate = false; // contents are already known
+        QString error;          // why the file is not a valid submarine
+    };
+
+    SubmarineImport() = delete;
+
+    static Result loadFile(QString const& filePath, QSet<QByteArray> const& knownHashes);
+    static QFuture<Result> loadDirectory(QString const& dirPath, QSet<QByteArray> const& knownHashes);
+    static bool isSubmarine(const char* data, size_t size);
+};
+
+#endif // SUBIMPORT_H
@@ -0,0 +1,108 @@
+#include "sublibrary.h"
+
+#include <QDir>
+#include <QFile>
+
+#include <stdexcept>
+
+#include <subimport.h>
+
+static const QString subExt = ".sub";
+static const qint64 headerReadSize = 64 * 1024; // enough compressed data to inflate the root element name
+
+SubmarineLibrary::SubmarineLibrary(QString const& dirPath) :
+    dirPath(dirPath)
+{
+}
+
+void SubmarineLibrary::setDirectory(const QString &dirPath) {
+    QWriteLocker locker(&lock);
+    this->dirPath = dirPath;
+    cache.clear();
+}
+
+QString SubmarineLibrary::directory() const {
+    QReadLocker locker(&lock);
+    return dirPath;
+}
+
+/* Look up a submarine by name, checking its contents if it's new or was modified
+ * @returns bool: false when there is no such submarine in the library
+ * @throws std::runtime_error: when the .sub file is corrupted
+ */
+bool SubmarineLibrary::find(const QString &name, Entry& entry) {
+    if (directory().isEmpty() || name.isEmpty() || name.contains('/') || name.contains('\\') || name.contains(".."))
+        return false;
+    QFileInfo info(directory() + QDir::separator() + name + subExt);
+    if (!info.isFile())
+        return false;
+    {
+        QReadLocker locker(&lock);
+        auto it = cache.constFind(name);
+        if (it != cache.constEnd() && it->checked && it->size == info.size() && it->modified == info.lastModified()) {
+            entry = *it;
+            return true;
+        }
+    }
+    entry = stat(info);
+    check(entry);
+    QWriteLocker locker(&lock);
+    cache.insert(name, entry);
+    return true;
+}
+
+// @returns QVector<Entry>: all cached submarines, call refresh() first to pick up changes
+QVector<SubmarineLibrary::Entry> SubmarineLibrary::entries() {
+    QReadLocker locker(&lock);
+    QVector<Entry> result;
+    result.reserve(cache.size());
+    for (Entry const& entry: cache)
+        result.push_back(entry);
+    return result;
+}
+
+// Rescan the library directory, files are only listed, not read
+void SubmarineLibrary::refresh() {
+    QDir dir(directory());
+    QHash<QString, Entry> updated;
+    for (QFileInfo const& info: dir.entryInfoList(QStringList("*" + subExt), QDir::Files)) {
+        QString name = info.completeBaseName();
+        if (isCurrent(name, info.size(), info.lastModified())) {
+            QReadLocker locker(&lock);
+            updated.insert(name, cache.value(name));
+        } else {
+            updated.insert(name, stat(info));
+        }
+    }
+    QWriteLocker locker(&lock);
+    cache.swap(updated);
+}
+
+// Entry of a file that was not read yet
+SubmarineLibrary::Entry SubmarineLibrary::stat(const QFileInfo &info) {
+    Entry entry;
+    entry.name = info.completeBaseName();
+    entry.path = info.absoluteFilePath();
+    entry.size = info.size();
+    entry.modified = info.lastModified();
+    return entry;
+}
+
+/* Verify that the file is a compressed submarine, only its beginning is read
+ * @throws std::runtime_error: when it isn't
+ */
+void SubmarineLibrary::check(Entry &entry) {
+    QFile file(entry.path);
+    if (!file.open(QFile::ReadOnly))
+        throw std::runtime_error(("Could not open submarine \"" + entry.path + "\"").toStdString());
+    QByteArray header = file.read(headerReadSize);
+    if (!SubmarineImport::isSubmarine(header.constData(), static_cast<size_t>(header.size())))
+        throw std::runtime_error(("Submarine \"" + entry.path + "\" is not a compressed submarine file").toStdString());
+    entry.checked = true;
+}
+
+bool SubmarineLibrary::isCurrent(const QString &name, qint64 size, const QDateTime &modified) const {
+    QReadLocker locker(&lock);
+    auto it = cache.constFind(name);
+    return it != cache.constEnd() && it->size == size && it->modified == modified;
+}
@@ -0,0 +1,46 @@
+#ifndef SUBLIBRARY_H
+#define SUBLIBRARY_H
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+/* Directory of .sub files
+ * Scanning the library only lists files, a submarine is read the first
+ * time it's looked up and again only when its size or modification time
+ * changes, so long running processes start fast on large libraries.
+ * All methods are thread safe.
+ */
+class SubmarineLibrary
+{
+public:
+    struct Entry {
+        QString name;         // file name without .sub
+        QString path;
+        qint64 size = 0;
+        QDateTime modified;
+        bool checked = false; // file was verified to be a compressed submarine
+    };
+
+    explicit SubmarineLibrary(QString const& dirPath = QString());
+
+    void setDirectory(QString const& dirPath);
+    QString directory() const;
+    bool find(QString const& name, Entry& entry);
+    QVector<Entry> entries();
+    void refresh();
+
+private:
+    static Entry stat(QFileInfo const& info);
+    static void check(Entry& entry);
+    bool isCurrent(QString const& name, qint64 size, QDateTime const& modified) const;
+
+    mutable QReadWriteLock lock;
+    QString dirPath;
+    QHash<QString, Entry> cache;
+};
+
+#endif // SUBLIBRARY_H
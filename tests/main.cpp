@@ -0,0 +1,41 @@
+#include <QCoreApplication>
+#include <QtTest>
+
+#include "tst_editjournal.h"
+#include "tst_locationindex.h"
+#include "tst_payloadstore.h"
+#include "tst_savedaemon.h"
+#include "tst_saveindex.h"
+#include "tst_subimport.h"
+
+// Run every test class, the exit code is non-zero if any of them failed
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    int status = 0;
+    {
+        TestEditJournal test;
+        status |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        TestSaveIndex test;
+        status |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        TestPayloadStore test;
+        status |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        TestLocationIndex test;
+        status |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        TestSubmarineImport test;
+        status |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        TestSaveDaemon test;
+        status |= QTest::qExec(&test, argc, argv);
+    }
+    return status;
+}
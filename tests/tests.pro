@@ -0,0 +1,50 @@
+#-------------------------------------------------
+#
+# Unit tests, run with: qmake tests/tests.pro && make check
+#
+#-------------------------------------------------
+
+QT       += core xml concurrent network testlib
+QT       -= gui
+
+TARGET = tests
+TEMPLATE = app
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += .. ../vendor
+
+SOURCES += \
+        main.cpp \
+    tst_editjournal.cpp \
+    tst_saveindex.cpp \
+    tst_payloadstore.cpp \
+    tst_locationindex.cpp \
+    tst_subimport.cpp \
+    tst_savedaemon.cpp \
+    ../batchio.cpp \
+    ../editjournal.cpp \
+    ../gamesession.cpp \
+    ../locationindex.cpp \
+    ../memoryaccounting.cpp \
+    ../payloadstore.cpp \
+    ../savedaemon.cpp \
+    ../saveindex.cpp \
+    ../saveutil.cpp \
+    ../subimport.cpp \
+    ../sublibrary.cpp \
+    ../zcodec.cpp
+
+HEADERS += \
+    tst_editjournal.h \
+    tst_saveindex.h \
+    tst_payloadstore.h \
+    tst_locationindex.h \
+    tst_subimport.h \
+    tst_savedaemon.h \
+    ../editjournal.h \
+    ../savedaemon.h
+
+LIBS += -lz
@@ -0,0 +1,104 @@
+#include "tst_editjournal.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <editjournal.h>
+#include <gamesession.h>
+
+static const QByteArray baseXml =
+        "<Gamesession><SinglePlayerCampaign money=\"100\"/>"
+        "<AvailableSubs><sub name=\"Dugong\"/></AvailableSubs></Gamesession>";
+
+// @returns QString: path of the journal file EditJournal keeps in dirPath
+static QString journalFile(QString const& dirPath) {
+    return dirPath + QDir::separator() + "session.journal";
+}
+
+void TestEditJournal::loadsCommittedRecords() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    EditJournal journal(dir.filePath("journal"));
+    journal.start("target.save", "base.save");
+    journal.recordEdit(GameSession::Edit::setMoney(500));
+    journal.recordEdit(GameSession::Edit::addSubmarine("Orca", GameSession::AvailableSubmarine));
+    journal.commit();
+
+    EditJournal::Contents contents;
+    QVERIFY(journal.load(contents));
+    QCOMPARE(contents.targetPath, QString("target.save"));
+    QCOMPARE(contents.basePath, QString("base.save"));
+    QCOMPARE(contents.records.size(), 2);
+    QCOMPARE(contents.records.at(0).edit.type, GameSession::Edit::SetMoney);
+    QCOMPARE(contents.records.at(0).edit.amount, qint64(500));
+    QCOMPARE(contents.records.at(1).edit.name, QString("Orca"));
+}
+
+void TestEditJournal::stopsAtTruncatedRecord() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString journalDir = dir.filePath("journal");
+    EditJournal journal(journalDir);
+    journal.start("target.save", "base.save");
+    journal.recordEdit(GameSession::Edit::setMoney(500));
+    journal.recordEdit(GameSession::Edit::setMoney(700));
+    journal.commit();
+
+    // a crash in the middle of a group commit leaves the last record torn
+    QFile file(journalFile(journalDir));
+    QVERIFY(file.resize(file.size() - 3));
+
+    EditJournal::Contents contents;
+    QVERIFY(journal.load(contents));
+    QCOMPARE(contents.records.size(), 1);
+    QCOMPARE(contents.records.at(0).edit.amount, qint64(500));
+}
+
+void TestEditJournal::replaysOntoBase() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString journalDir = dir.filePath("journal");
+    EditJournal journal(journalDir);
+    journal.start("target.save", "base.save");
+    journal.recordEdit(GameSession::Edit::setMoney(500));
+    journal.recordEdit(GameSession::Edit::addSubmarine("Orca", GameSession::AvailableSubmarine));
+    journal.recordEdit(GameSession::Edit::setMoney(900));
+    journal.commit();
+    QFile file(journalFile(journalDir));
+    QVERIFY(file.resize(file.size() - 1));
+
+    EditJournal::Contents contents;
+    QVERIFY(journal.load(contents));
+    GameSession session;
+    QVERIFY(session.setContent(baseXml));
+    for (EditJournal::Record const& record: contents.records) {
+        QCOMPARE(record.type, EditJournal::Record::SessionEdit);
+        session.apply(record.edit);
+    }
+    // edits before the torn record are recovered, the torn one is lost
+    QCOMPARE(session.getMoney(), qint64(500));
+    QVERIFY(session.containsSubmarine("Orca", GameSession::AvailableSubmarine));
+}
+
+void TestEditJournal::requestsCompactionAgain() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    EditJournal journal(dir.filePath("journal"));
+    journal.setSizeThreshold(1);
+    journal.start("target.save", "base.save");
+    QSignalSpy spy(&journal, SIGNAL(compactionNeeded()));
+    journal.recordEdit(GameSession::Edit::setMoney(500));
+    journal.commit();
+    QCOMPARE(spy.count(), 1);
+    // requested once until the checkpoint finishes or fails
+    journal.recordEdit(GameSession::Edit::setMoney(600));
+    journal.commit();
+    QCOMPARE(spy.count(), 1);
+    journal.compactionFailed();
+    journal.recordEdit(GameSession::Edit::setMoney(700));
+    journal.commit();
+    QCOMPARE(spy.count(), 2);
+}
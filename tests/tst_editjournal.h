@@ -0,0 +1,16 @@
+#ifndef TST_EDITJOURNAL_H
+#define TST_EDITJOURNAL_H
+
+#include <QObject>
+
+class TestEditJournal : public QObject
+{
+    Q_OBJECT
+private slots:
+    void loadsCommittedRecords();
+    void stopsAtTruncatedRecord();
+    void replaysOntoBase();
+    void requestsCompactionAgain();
+};
+
+#endif // TST_EDITJOURNAL_H
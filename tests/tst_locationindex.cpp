@@ -0,0 +1,110 @@
+#include "tst_locationindex.h"
+
+#include <QStringList>
+#include <QtTest>
+
+#include <locationindex.h>
+
+static const char* const mapXml =
+        "<Gamesession><map>"
+        "<location name=\"Alpha\" type=\"Outpost\" position=\"0,0\"><store><item id=\"oxygentank\" qty=\"2\"/></store></location>"
+        "<location name=\"Beta\" type=\"outpost\" position=\"100,0\"/>"
+        "<location name=\"Gamma\" type=\"City\" position=\"1000,1000\"><store/></location>"
+        "<location name=\"Delta\" type=\"city\" position=\"-500,20\"/>"
+        "<location name=\"Beta\" type=\"ruin\" position=\"5000,5000\"/>"
+        "</map></Gamesession>";
+
+static QStringList namesOf(LocationIndex const& index, QVector<int> const& selected) {
+    QStringList names;
+    for (int i: selected)
+        names.push_back(index.at(i).name);
+    return names;
+}
+
+void TestLocationIndex::init() {
+    QVERIFY(tree.setContent(QByteArray(mapXml)));
+}
+
+void TestLocationIndex::indexesAllLocations() {
+    LocationIndex index;
+    QVERIFY(!index.isBuilt());
+    index.build(tree);
+    QVERIFY(index.isBuilt());
+    QCOMPARE(index.size(), 5);
+    QCOMPARE(index.at(2).position, QPointF(1000, 1000));
+    QVERIFY(!index.at(0).store.isNull());
+    QVERIFY(index.at(1).store.isNull());
+    QCOMPARE(namesOf(index, index.select(LocationIndex::Filter())).size(), 5);
+}
+
+void TestLocationIndex::filtersByType() {
+    LocationIndex index;
+    index.build(tree);
+    LocationIndex::Filter filter;
+    filter.type = "OUTPOST"; // types compare case insensitively
+    QCOMPARE(namesOf(index, index.select(filter)), QStringList({"Alpha", "Beta"}));
+    filter.type = "missing";
+    QVERIFY(index.select(filter).isEmpty());
+}
+
+void TestLocationIndex::filtersByName() {
+    LocationIndex index;
+    index.build(tree);
+    LocationIndex::Filter filter;
+    filter.name = "Beta";
+    QCOMPARE(index.select(filter), QVector<int>({1, 4}));
+}
+
+void TestLocationIndex::filtersByRadius() {
+    LocationIndex index;
+    index.build(tree);
+    LocationIndex::Filter filter;
+    filter.center = QPointF(50, 0);
+    filter.radius = 60;
+    QCOMPARE(namesOf(index, index.select(filter)), QStringList({"Alpha", "Beta"}));
+    filter.radius = 600;
+    QCOMPARE(namesOf(index, index.select(filter)), QStringList({"Alpha", "Beta", "Delta"}));
+    // far outside of the map
+    filter.center = QPointF(1e12, -1e12);
+    filter.radius = 10;
+    QVERIFY(index.select(filter).isEmpty());
+}
+
+void TestLocationIndex::combinesFilters() {
+    LocationIndex index;
+    index.build(tree);
+    LocationIndex::Filter filter;
+    filter.name = "Beta";
+    filter.type = "ruin";
+    QCOMPARE(index.select(filter), QVector<int>({4}));
+    filter.type = "city";
+    filter.name.clear();
+    filter.center = QPointF(0, 0);
+    filter.radius = 600;
+    QCOMPARE(namesOf(index, index.select(filter)), QStringList({"Delta"}));
+}
+
+void TestLocationIndex::appliesEdits() {
+    LocationIndex index;
+    index.build(tree);
+    LocationIndex::Edit reputation;
+    reputation.action = LocationIndex::Edit::SetReputation;
+    reputation.filter.type = "outpost";
+    reputation.value = 50;
+    LocationIndex::Edit restock;
+    restock.action = LocationIndex::Edit::Restock;
+    restock.filter.type = "outpost";
+    restock.item = "oxygentank";
+    restock.value = 10;
+    LocationIndex::Edit unmatched;
+    unmatched.filter.name = "missing";
+
+    QVector<bool> changedBy;
+    // Alpha gets both edits, Beta only the reputation as it has no store
+    QCOMPARE(index.apply({reputation, restock, unmatched}, &changedBy), 2);
+    QCOMPARE(changedBy, QVector<bool>({true, true, false}));
+    QCOMPARE(index.at(0).element.attribute("reputation"), QString("50"));
+    QCOMPARE(index.at(1).element.attribute("reputation"), QString("50"));
+    QVERIFY(!index.at(2).element.hasAttribute("reputation"));
+    QCOMPARE(index.at(0).store.firstChildElement("item").attribute("qty"), QString("10"));
+}
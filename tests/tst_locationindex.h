@@ -0,0 +1,23 @@
+#ifndef TST_LOCATIONINDEX_H
+#define TST_LOCATIONINDEX_H
+
+#include <QDomDocument>
+#include <QObject>
+
+class TestLocationIndex : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void indexesAllLocations();
+    void filtersByType();
+    void filtersByName();
+    void filtersByRadius();
+    void combinesFilters();
+    void appliesEdits();
+
+private:
+    QDomDocument tree;
+};
+
+#endif // TST_LOCATIONINDEX_H
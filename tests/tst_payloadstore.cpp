@@ -0,0 +1,49 @@
+#include "tst_payloadstore.h"
+
+#include <QCryptographicHash>
+#include <QtTest>
+
+#include <payloadstore.h>
+
+void TestPayloadStore::sharesIdenticalContents() {
+    PayloadStore store;
+    QByteArray data("submarine contents");
+    PayloadRef first = store.intern(data);
+    PayloadRef second = store.intern(data.constData(), static_cast<size_t>(data.size()));
+    PayloadRef third = store.intern(data, QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex());
+    QCOMPARE(first.get(), second.get());
+    QCOMPARE(first.get(), third.get());
+    QCOMPARE(store.count(), 1);
+    QCOMPARE(store.bytes(), qint64(data.size()));
+    QCOMPARE(store.find(first->hash).get(), first.get());
+
+    PayloadRef other = store.intern(QByteArray("other contents"));
+    QVERIFY(other.get() != first.get());
+    QCOMPARE(store.count(), 2);
+}
+
+void TestPayloadStore::releasesWithLastReference() {
+    PayloadStore store;
+    PayloadRef first = store.intern(QByteArray("submarine contents"));
+    PayloadRef copy = first;
+    QByteArray hash = first->hash;
+    first.reset();
+    QCOMPARE(store.count(), 1);
+    QVERIFY(store.find(hash) != nullptr);
+
+    copy.reset();
+    QCOMPARE(store.count(), 0);
+    QCOMPARE(store.bytes(), qint64(0));
+    QVERIFY(store.find(hash) == nullptr);
+}
+
+void TestPayloadStore::reinternsAfterRelease() {
+    PayloadStore store;
+    QByteArray data("submarine contents");
+    store.intern(data).reset();
+    PayloadRef again = store.intern(data);
+    QVERIFY(again != nullptr);
+    QCOMPARE(again->data, data);
+    QCOMPARE(store.count(), 1);
+    QCOMPARE(store.bytes(), qint64(data.size()));
+}
@@ -0,0 +1,15 @@
+#ifndef TST_PAYLOADSTORE_H
+#define TST_PAYLOADSTORE_H
+
+#include <QObject>
+
+class TestPayloadStore : public QObject
+{
+    Q_OBJECT
+private slots:
+    void sharesIdenticalContents();
+    void releasesWithLastReference();
+    void reinternsAfterRelease();
+};
+
+#endif // TST_PAYLOADSTORE_H
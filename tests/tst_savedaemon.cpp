@@ -0,0 +1,214 @@
+#include "tst_savedaemon.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtTest>
+
+#include <stdexcept>
+
+#include <gamesession.h>
+#include <savedaemon.h>
+#include <saveutil.h>
+#include <zcodec.h>
+
+static const int timeoutMsec = 10000;
+
+static const QByteArray sessionXml =
+        "<Gamesession submarine=\"Dugong\"><SinglePlayerCampaign money=\"100\"><map>"
+        "<location name=\"Alpha\" type=\"outpost\" position=\"0,0\"/>"
+        "<location name=\"Beta\" type=\"city\" position=\"100,0\"/>"
+        "</map></SinglePlayerCampaign>"
+        "<AvailableSubs><sub name=\"Dugong\"/></AvailableSubs>"
+        "<ownedsubmarines><sub name=\"Dugong\"/></ownedsubmarines></Gamesession>";
+
+static QByteArray gzipped(QByteArray const& xml) {
+    std::string data = ZCodec::local().compress(xml.constData(), static_cast<size_t>(xml.size()));
+    return QByteArray(data.data(), static_cast<int>(data.size()));
+}
+
+static bool writeFile(QString const& path, QByteArray const& data) {
+    QFile file(path);
+    return file.open(QFile::WriteOnly) && file.write(data) == data.size();
+}
+
+static QByteArray readFile(QString const& path) {
+    QFile file(path);
+    return file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+// Wait for a client running on a worker thread, the daemon is served by this thread's event loop
+template <typename T>
+static T waitFor(QFuture<T> future) {
+    while (!future.isFinished())
+        QTest::qWait(10);
+    return future.result();
+}
+
+// @returns QJsonObject: response of the daemon, empty if it didn't answer
+static QJsonObject send(QString const& socketName, QJsonObject const& request) {
+    QByteArray json = QJsonDocument(request).toJson(QJsonDocument::Compact);
+    QByteArray response = waitFor(QtConcurrent::run([socketName, json]() {
+        try {
+            return SaveDaemon::request(socketName, json, timeoutMsec);
+        } catch (std::runtime_error const&) {
+            return QByteArray();
+        }
+    }));
+    return QJsonDocument::fromJson(response).object();
+}
+
+// Send several jobs on one connection before reading any response
+static QList<QJsonObject> sendAll(QString const& socketName, QList<QJsonObject> const& requests) {
+    QByteArray lines;
+    for (QJsonObject const& request: requests)
+        lines += QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n';
+    int count = requests.size();
+    QList<QByteArray> responses = waitFor(QtConcurrent::run([socketName, lines, count]() {
+        QList<QByteArray> received;
+        QLocalSocket socket;
+        socket.connectToServer(socketName);
+        if (!socket.waitForConnected(timeoutMsec))
+            return received;
+        socket.write(lines);
+        socket.waitForBytesWritten(timeoutMsec);
+        while (received.size() < count) {
+            if (!socket.canReadLine() && !socket.waitForReadyRead(timeoutMsec))
+                break;
+            while (socket.canReadLine())
+                received.push_back(socket.readLine().trimmed());
+        }
+        return received;
+    }));
+    QList<QJsonObject> objects;
+    for (QByteArray const& response: responses)
+        objects.push_back(QJsonDocument::fromJson(response).object());
+    return objects;
+}
+
+static bool readSession(QString const& savePath, GameSession& session) {
+    return session.setContent(SaveUtil::readEntry(savePath, "gamesession.xml"));
+}
+
+void TestSaveDaemon::init() {
+    static int instance = 0;
+    dir.reset(new QTemporaryDir);
+    QVERIFY(dir->isValid());
+    savePath = dir->filePath("campaign.save");
+    libraryPath = dir->filePath("Submarines");
+    QVERIFY(QDir().mkpath(libraryPath));
+    QVERIFY(writeFile(libraryPath + "/Orca.sub", gzipped("<Submarine name=\"Orca\" price=\"5000\"/>")));
+    QVERIFY(writeFile(libraryPath + "/Broken.sub", "<Submarine name=\"Broken\"/>"));
+    SaveUtil::compressFiles(QStringList(), {
+                                SaveUtil::MemoryFile{"gamesession.xml", sessionXml},
+                                SaveUtil::MemoryFile{"Dugong.sub", gzipped("<Submarine name=\"Dugong\"/>")}
+                            }, savePath);
+
+    socketName = QString("saveeditor-test-%1-%2").arg(QCoreApplication::applicationPid()).arg(++instance);
+    daemon.reset(new SaveDaemon(libraryPath));
+    QVERIFY(daemon->listen(socketName));
+}
+
+void TestSaveDaemon::cleanup() {
+    daemon.reset();
+    dir.reset();
+}
+
+void TestSaveDaemon::queriesSave() {
+    QJsonObject response = send(socketName, QJsonObject{{"id", 7}, {"op", "query"}, {"save", savePath},
+                                                         {"locations", QJsonObject{{"type", "Outpost"}}}});
+    QVERIFY(response.value("ok").toBool());
+    QCOMPARE(response.value("id").toInt(), 7);
+    QCOMPARE(response.value("money").toVariant().toLongLong(), qint64(100));
+    QCOMPARE(response.value("submarine").toString(), QString("Dugong"));
+    QCOMPARE(response.value("available").toArray(), QJsonArray{"Dugong"});
+    QJsonArray locations = response.value("locations").toArray();
+    QCOMPARE(locations.size(), 1);
+    QCOMPARE(locations.at(0).toObject().value("name").toString(), QString("Alpha"));
+    QVERIFY(response.value("memory").isObject());
+}
+
+void TestSaveDaemon::editsSave() {
+    QJsonArray edits{
+        QJsonObject{{"type", "setMoney"}, {"amount", 5000}},
+        QJsonObject{{"type", "addSub"}, {"name", "Orca"}},
+        QJsonObject{{"type", "editLocations"}, {"action", "setReputation"}, {"value", 50},
+                    {"filter", QJsonObject{{"type", "outpost"}}}}
+    };
+    QJsonObject response = send(socketName, QJsonObject{{"op", "edit"}, {"save", savePath}, {"edits", edits}});
+    QVERIFY2(response.value("ok").toBool(), qPrintable(response.value("error").toString()));
+    QCOMPARE(response.value("applied").toInt(), 3);
+    QCOMPARE(response.value("locationsChanged").toInt(), 1);
+
+    GameSession session;
+    QVERIFY(readSession(savePath, session));
+    QCOMPARE(session.getMoney(), qint64(5000));
+    QVERIFY(session.containsSubmarine("Orca", GameSession::AvailableSubmarine));
+    // the submarine is copied from the library into the save
+    QCOMPARE(SaveUtil::readEntry(savePath, "Orca.sub"), readFile(libraryPath + "/Orca.sub"));
+    QCOMPARE(SaveUtil::readEntry(savePath, "gamesession.xml").count("reputation=\"50\""), 1);
+}
+
+void TestSaveDaemon::rejectsInvalidSubmarines() {
+    QByteArray original = readFile(savePath);
+    QString outside = dir->filePath("outside.sub");
+    QVERIFY(writeFile(outside, "keep"));
+    QString escaping = QDir(QDir::tempPath()).relativeFilePath(dir->filePath("outside"));
+
+    for (QString const& name: {QString("../") + escaping, QString("..\\outside"), QString("..")}) {
+        QJsonArray edits{QJsonObject{{"type", "removeSub"}, {"name", name}}};
+        QJsonObject response = send(socketName, QJsonObject{{"op", "edit"}, {"save", savePath}, {"edits", edits}});
+        QVERIFY(!response.value("ok").toBool());
+        QVERIFY(response.value("error").toString().contains("Invalid submarine name"));
+    }
+    QVERIFY(QFile::exists(outside));
+
+    // not compressed, caught when it's first looked up
+    QJsonArray edits{QJsonObject{{"type", "addSub"}, {"name", "Broken"}}};
+    QJsonObject response = send(socketName, QJsonObject{{"op", "edit"}, {"save", savePath}, {"edits", edits}});
+    QVERIFY(!response.value("ok").toBool());
+    QVERIFY(response.value("error").toString().contains("not a compressed submarine"));
+
+    // failed jobs leave the save untouched
+    QCOMPARE(readFile(savePath), original);
+}
+
+void TestSaveDaemon::appliesQueuedEditsInOrder() {
+    QJsonArray add{QJsonObject{{"type", "addSub"}, {"name", "Orca"}}};
+    QJsonArray remove{QJsonObject{{"type", "removeSub"}, {"name", "Orca"}}};
+    QList<QJsonObject> responses = sendAll(socketName, {
+                                               QJsonObject{{"id", 1}, {"op", "edit"}, {"save", savePath}, {"edits", add}},
+                                               QJsonObject{{"id", 2}, {"op", "edit"}, {"save", savePath}, {"edits", remove}}
+                                           });
+    QCOMPARE(responses.size(), 2);
+    for (int i = 0; i < 2; i++) {
+        QVERIFY2(responses.at(i).value("ok").toBool(), qPrintable(responses.at(i).value("error").toString()));
+        QCOMPARE(responses.at(i).value("id").toInt(), i + 1);
+        QCOMPARE(responses.at(i).value("applied").toInt(), 1);
+    }
+    // removing first would have been a no-op, leaving the submarine in the save
+    GameSession session;
+    QVERIFY(readSession(savePath, session));
+    QVERIFY(!session.containsSubmarine("Orca"));
+    QVERIFY_EXCEPTION_THROWN(SaveUtil::readEntry(savePath, "Orca.sub"), std::runtime_error);
+}
+
+void TestSaveDaemon::reportsStats() {
+    QVERIFY(send(socketName, QJsonObject{{"op", "query"}, {"save", savePath}}).value("ok").toBool());
+    QJsonArray edits{QJsonObject{{"type", "unknown"}}};
+    QVERIFY(!send(socketName, QJsonObject{{"op", "edit"}, {"save", savePath}, {"edits", edits}}).value("ok").toBool());
+
+    QJsonObject stats = send(socketName, QJsonObject{{"id", "s"}, {"op", "stats"}});
+    QVERIFY(stats.value("ok").toBool());
+    QCOMPARE(stats.value("id").toString(), QString("s"));
+    QCOMPARE(stats.value("completed").toInt(), 1);
+    QCOMPARE(stats.value("failed").toInt(), 1);
+    QCOMPARE(stats.value("queued").toInt(), 0);
+    QCOMPARE(stats.value("running").toInt(), 0);
+    QCOMPARE(daemon->stats().completed, qint64(1));
+}
@@ -0,0 +1,30 @@
+#ifndef TST_SAVEDAEMON_H
+#define TST_SAVEDAEMON_H
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+
+#include <savedaemon.h>
+
+class TestSaveDaemon : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanup();
+    void queriesSave();
+    void editsSave();
+    void rejectsInvalidSubmarines();
+    void appliesQueuedEditsInOrder();
+    void reportsStats();
+
+private:
+    QScopedPointer<QTemporaryDir> dir;
+    QScopedPointer<SaveDaemon> daemon;
+    QString socketName;
+    QString savePath;
+    QString libraryPath;
+};
+
+#endif // TST_SAVEDAEMON_H
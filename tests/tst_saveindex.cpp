@@ -0,0 +1,75 @@
+#include "tst_saveindex.h"
+
+#include <QtTest>
+
+#include <saveindex.h>
+#include <saveutil.h>
+
+static const quint64 testSpan = 64 * 1024; // small span, so entries cross several access points
+
+// Text that compresses like XML but not to nothing, deterministic for every run
+static QByteArray makeContent(quint32 seed, int size) {
+    static const char* const words[] = {"<Item ", "identifier=\"", "oxygentank", "\" ", "condition=\"",
+                                        "100", "/>\n", "<Location ", "name=\"", "outpost", "reputation=\""};
+    QByteArray content;
+    content.reserve(size);
+    quint32 state = seed;
+    while (content.size() < size) {
+        state = state * 1664525u + 1013904223u;
+        content += words[(state >> 24) % 11];
+        content += QByteArray::number(state % 9973);
+    }
+    content.resize(size);
+    return content;
+}
+
+void TestSaveIndex::initTestCase() {
+    QVERIFY(dir.isValid());
+    savePath = dir.filePath("test.save");
+    contents.insert("gamesession.xml", makeContent(1, 200 * 1024));
+    contents.insert("Dugong.sub", makeContent(2, 350 * 1024));
+    contents.insert("empty.txt", QByteArray());
+    contents.insert("Orca.sub", makeContent(3, 120 * 1024));
+    QVector<SaveUtil::MemoryFile> files;
+    for (auto it = contents.constBegin(); it != contents.constEnd(); ++it)
+        files.push_back(SaveUtil::MemoryFile{it.key(), it.value()});
+    SaveUtil::compressFiles(QStringList(), files, savePath);
+}
+
+void TestSaveIndex::indexesEveryEntry() {
+    SaveIndex index;
+    index.build(savePath, testSpan);
+    QCOMPARE(index.entries().size(), contents.size());
+    for (auto it = contents.constBegin(); it != contents.constEnd(); ++it) {
+        SaveIndex::Entry const* entry = index.find(it.key());
+        QVERIFY(entry != nullptr);
+        QCOMPARE(entry->contentLength, static_cast<quint32>(it.value().size()));
+    }
+    QVERIFY(index.find("missing.sub") == nullptr);
+}
+
+void TestSaveIndex::readsMatchFullDecompress() {
+    QMap<QString, QByteArray> full;
+    SaveUtil::readArchive(savePath, [&full](QString const& fileName, const char* content, size_t size) {
+        full.insert(fileName, QByteArray(content, static_cast<int>(size)));
+    });
+    QCOMPARE(full, contents);
+
+    SaveIndex index;
+    index.build(savePath, testSpan);
+    for (auto it = full.constBegin(); it != full.constEnd(); ++it)
+        QCOMPARE(index.readEntry(savePath, it.key()), it.value());
+}
+
+void TestSaveIndex::readsAfterReload() {
+    // SaveUtil::readEntry creates the sidecar index, the second read goes through it
+    QCOMPARE(SaveUtil::readEntry(savePath, "Dugong.sub", true), contents.value("Dugong.sub"));
+    QString indexPath = SaveIndex::indexPathFor(savePath);
+    QVERIFY(QFile::exists(indexPath));
+    SaveIndex index;
+    QVERIFY(index.load(indexPath));
+    QVERIFY(index.matches(savePath));
+    for (auto it = contents.constBegin(); it != contents.constEnd(); ++it)
+        QCOMPARE(index.readEntry(savePath, it.key()), it.value());
+    QCOMPARE(SaveUtil::readEntry(savePath, "Orca.sub", true), contents.value("Orca.sub"));
+}
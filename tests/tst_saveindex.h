@@ -0,0 +1,23 @@
+#ifndef TST_SAVEINDEX_H
+#define TST_SAVEINDEX_H
+
+#include <QMap>
+#include <QObject>
+#include <QTemporaryDir>
+
+class TestSaveIndex : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void indexesEveryEntry();
+    void readsMatchFullDecompress();
+    void readsAfterReload();
+
+private:
+    QTemporaryDir dir;
+    QString savePath;
+    QMap<QString, QByteArray> contents; // entries written to savePath
+};
+
+#endif // TST_SAVEINDEX_H
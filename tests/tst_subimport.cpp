@@ -0,0 +1,91 @@
+#include "tst_subimport.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <subimport.h>
+#include <zcodec.h>
+
+static const QByteArray submarineA = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<Submarine name=\"A\"><Item/></Submarine>";
+static const QByteArray submarineB = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<Submarine name=\"B\"><Item/></Submarine>";
+
+static QByteArray gzipped(QByteArray const& xml) {
+    std::string data = ZCodec::local().compress(xml.constData(), static_cast<size_t>(xml.size()));
+    return QByteArray(data.data(), static_cast<int>(data.size()));
+}
+
+static QByteArray hashOf(QByteArray const& data) {
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+static bool writeFile(QString const& path, QByteArray const& data) {
+    QFile file(path);
+    return file.open(QFile::WriteOnly) && file.write(data) == data.size();
+}
+
+// a.sub and c.sub have the same contents, bad.sub is not compressed
+static bool writeLibrary(QTemporaryDir const& dir, QByteArray const& fileA) {
+    return writeFile(dir.filePath("a.sub"), fileA) &&
+           writeFile(dir.filePath("b.sub"), gzipped(submarineB)) &&
+           writeFile(dir.filePath("bad.sub"), submarineA) &&
+           writeFile(dir.filePath("c.sub"), fileA) &&
+           writeFile(dir.filePath("notes.txt"), gzipped(submarineB));
+}
+
+void TestSubmarineImport::skipsKnownContents() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QByteArray fileA = gzipped(submarineA);
+    QVERIFY(writeLibrary(dir, fileA));
+    QByteArray knownHash = hashOf(fileA);
+
+    QList<SubmarineImport::Result> results = SubmarineImport::loadDirectory(dir.path(), {knownHash}).results();
+    QCOMPARE(results.size(), 4);
+    QCOMPARE(results.at(0).fileName, QString("a.sub"));
+    QCOMPARE(results.at(1).fileName, QString("b.sub"));
+    QCOMPARE(results.at(2).fileName, QString("bad.sub"));
+    QCOMPARE(results.at(3).fileName, QString("c.sub"));
+
+    for (int i: {0, 3}) {
+        QVERIFY(results.at(i).duplicate);
+        QVERIFY(!results.at(i).payload);
+        QCOMPARE(results.at(i).hash, knownHash);
+        QVERIFY(results.at(i).error.isEmpty());
+    }
+
+    QVERIFY(!results.at(1).duplicate);
+    QVERIFY(results.at(1).error.isEmpty());
+    QVERIFY(results.at(1).payload);
+    QCOMPARE(results.at(1).payload->hash, results.at(1).hash);
+
+    QVERIFY(!results.at(2).duplicate);
+    QVERIFY(!results.at(2).payload);
+    QVERIFY(!results.at(2).error.isEmpty());
+}
+
+void TestSubmarineImport::sharesIdenticalFiles() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writeLibrary(dir, gzipped(submarineA)));
+
+    QList<SubmarineImport::Result> results = SubmarineImport::loadDirectory(dir.path(), {}).results();
+    QCOMPARE(results.size(), 4);
+    QVERIFY(!results.at(0).duplicate);
+    QVERIFY(!results.at(3).duplicate);
+    QVERIFY(results.at(0).payload);
+    QCOMPARE(results.at(0).payload.get(), results.at(3).payload.get());
+    QVERIFY(results.at(0).payload.get() != results.at(1).payload.get());
+}
+
+void TestSubmarineImport::checksRootElement() {
+    QByteArray submarine = gzipped(submarineA);
+    QVERIFY(SubmarineImport::isSubmarine(submarine.constData(), static_cast<size_t>(submarine.size())));
+    QByteArray commented = gzipped("<!-- saved by the editor --><submarine/>");
+    QVERIFY(SubmarineImport::isSubmarine(commented.constData(), static_cast<size_t>(commented.size())));
+
+    QByteArray item = gzipped("<?xml version=\"1.0\"?>\n<Item name=\"Submarine\"/>");
+    QVERIFY(!SubmarineImport::isSubmarine(item.constData(), static_cast<size_t>(item.size())));
+    QVERIFY(!SubmarineImport::isSubmarine(submarineA.constData(), static_cast<size_t>(submarineA.size())));
+}
@@ -0,0 +1,15 @@
+#ifndef TST_SUBIMPORT_H
+#define TST_SUBIMPORT_H
+
+#include <QObject>
+
+class TestSubmarineImport : public QObject
+{
+    Q_OBJECT
+private slots:
+    void skipsKnownContents();
+    void sharesIdenticalFiles();
+    void checksRootElement();
+};
+
+#endif // TST_SUBIMPORT_H
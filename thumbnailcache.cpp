@@ -0,0 +1,154 @@
+#include "thumbnailcache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+
+#include <algorithm>
+
+#include <gzip-cpp/config.hpp>
+#include <zlib.h>
+
+static const QByteArray previewAttribute = "previewimage=\"";
+static const unsigned inflateChunk = 64 * 1024;
+static const int maxPreviewSize = 64 * 1024 * 1024; // give up on absurdly large previews
+
+// @returns int: position of '>' closing the root element start tag, -1 if not inflated yet
+static int rootElementEnd(QByteArray const& xml) {
+    for (int i = xml.indexOf('<'); i >= 0 && i + 1 < xml.size(); i = xml.indexOf('<', i + 1)) {
+        char next = xml.at(i + 1);
+        if (next != '?' && next != '!')
+            return xml.indexOf('>', i);
+    }
+    return -1;
+}
+
+ThumbnailCache::ThumbnailCache(QSize const& thumbnailSize, QObject* parent) :
+    QObject(parent),
+    size(thumbnailSize)
+{
+    QString cacheRoot = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    cacheDir = (cacheRoot.isEmpty() ? QString(".") : cacheRoot) + QDir::separator() + "thumbnails";
+    // leave a core for the GUI thread
+    workers.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+ThumbnailCache::~ThumbnailCache() {
+    workers.clear();
+    workers.waitForDone();
+}
+
+/* Prepare thumbnail of a .sub file in the background
+ * thumbnailReady is emitted with the same key when (and if) the thumbnail is ready.
+ * @param key: SHA-1 of subData, hex encoded, names the file in the disk cache
+ * @param subData: compressed contents of the .sub file
+ */
+void ThumbnailCache::request(const QString &key, const QByteArray &subData) {
+    if (inFlight.contains(key))
+        return;
+    inFlight.insert(key);
+    QByteArray hash = key.toLatin1();
+    workers.start([this, key, hash, subData]() {
+        QImage image = loadThumbnail(hash, subData);
+        QMetaObject::invokeMethod(this, [this, key, image]() {
+            finished(key, image);
+        }, Qt::QueuedConnection);
+    });
+}
+
+QSize ThumbnailCache::thumbnailSize() const {
+    return size;
+}
+
+/* Read the preview image embedded in a compressed .sub file
+ * Data is inflated only up to the end of the previewimage attribute.
+ * @returns QByteArray: encoded image, empty if the submarine has no preview
+ */
+QByteArray ThumbnailCache::readPreviewImage(const char* data, size_t size) {
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.avail_in = 0;
+    stream.next_in = Z_NULL;
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+        return QByteArray();
+    stream.next_in = reinterpret_cast<z_const Bytef*>(data);
+    stream.avail_in = static_cast<unsigned int>(size);
+
+    QByteArray xml;
+    QByteArray preview;
+    int valueStart = -1; // first character of the attribute value
+    int searchFrom = 0;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        int oldSize = xml.size();
+        xml.resize(oldSize + static_cast<int>(inflateChunk));
+        stream.next_out = reinterpret_cast<Bytef*>(xml.data() + oldSize);
+        stream.avail_out = inflateChunk;
+        ret = inflate(&stream, Z_NO_FLUSH);
+        xml.resize(oldSize + static_cast<int>(inflateChunk - stream.avail_out));
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+
+        if (valueStart < 0) {
+            int found = xml.indexOf(previewAttribute, searchFrom);
+            int rootEnd = rootElementEnd(xml);
+            if (found >= 0 && (rootEnd < 0 || found < rootEnd)) {
+                valueStart = found + previewAttribute.size();
+                searchFrom = valueStart;
+            } else if (rootEnd >= 0) {
+                break; // root element has no preview
+            } else {
+                searchFrom = std::max(0, xml.size() - previewAttribute.size());
+            }
+        }
+        if (valueStart >= 0) {
+            int valueEnd = xml.indexOf('"', searchFrom);
+            if (valueEnd >= 0) {
+                preview = QByteArray::fromBase64(xml.mid(valueStart, valueEnd - valueStart));
+                break;
+            }
+            searchFrom = xml.size();
+            if (xml.size() - valueStart > maxPreviewSize)
+                break;
+        }
+    }
+    inflateEnd(&stream);
+    return preview;
+}
+
+// Load thumbnail from disk cache or decode it from the submarine (runs on a worker thread)
+QImage ThumbnailCache::loadThumbnail(const QByteArray &hash, const QByteArray &compressed) const {
+    QImage image;
+    QString cached = cachePath(hash);
+    if (image.load(cached, "PNG"))
+        return image;
+
+    QByteArray preview = readPreviewImage(compressed.constData(), static_cast<size_t>(compressed.size()));
+    if (preview.isEmpty())
+        return QImage();
+    image = QImage::fromData(preview);
+    if (image.isNull())
+        return image;
+    image = image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    QDir().mkpath(cacheDir);
+    QSaveFile cacheFile(cached);
+    if (cacheFile.open(QFile::WriteOnly) && image.save(&cacheFile, "PNG"))
+        cacheFile.commit();
+    return image;
+}
+
+QString ThumbnailCache::cachePath(const QByteArray &hash) const {
+    return cacheDir + QDir::separator() +
+            QString("%1-%2x%3.png").arg(QString::fromLatin1(hash)).arg(size.width()).arg(size.height());
+}
+
+void ThumbnailCache::finished(const QString &key, const QImage &image) {
+    inFlight.remove(key);
+    if (!image.isNull())
+        emit thumbnailReady(key, image);
+}
@@ -0,0 +1,45 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QObject>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+
+/* Submarine preview thumbnails
+ * .sub files embed a base64 preview image in the root element, it is read
+ * by inflating only up to the end of that attribute. Decoding and scaling
+ * happen on worker threads, results are kept in an on-disk cache keyed by
+ * the content hash of the .sub file.
+ */
+class ThumbnailCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ThumbnailCache(QSize const& thumbnailSize, QObject* parent = nullptr);
+    ~ThumbnailCache() override;
+
+    void request(QString const& key, QByteArray const& subData);
+    QSize thumbnailSize() const;
+
+    static QByteArray readPreviewImage(const char* data, size_t size);
+
+signals:
+    // emitted on the thread owning the cache
+    void thumbnailReady(QString const& key, QImage const& image);
+
+private:
+    QImage loadThumbnail(QByteArray const& hash, QByteArray const& subData) const;
+    QString cachePath(QByteArray const& hash) const;
+    void finished(QString const& key, QImage const& image);
+
+    QSize size;
+    QString cacheDir;
+    QThreadPool workers;
+    QSet<QString> inFlight; // keys with a thumbnail being prepared
+};
+
+#endif // THUMBNAILCACHE_H
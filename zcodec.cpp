@@ -0,0 +1,135 @@
+#include "zcodec.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+// same window sizes as gzip-cpp
+static constexpr int inflateWindowBits = 15 + 32; // auto detect gzip/zlib header
+static constexpr int deflateWindowBits = 15 + 16; // gzip
+static constexpr int deflateMemLevel = 8;
+
+ZCodec::ZCodec(size_t maxBytes) :
+    maxBytes(maxBytes)
+{
+}
+
+ZCodec::~ZCodec() {
+    if (inflateReady)
+        inflateEnd(&inflateStream);
+    if (deflateReady)
+        deflateEnd(&deflateStream);
+}
+
+ZCodec& ZCodec::local() {
+    thread_local ZCodec codec;
+    return codec;
+}
+
+void ZCodec::initInflate() {
+    if (inflateReady) {
+        if (inflateReset(&inflateStream) == Z_OK)
+            return;
+        inflateEnd(&inflateStream);
+        inflateReady = false;
+    }
+    inflateStream.zalloc = Z_NULL;
+    inflateStream.zfree = Z_NULL;
+    inflateStream.opaque = Z_NULL;
+    inflateStream.avail_in = 0;
+    inflateStream.next_in = Z_NULL;
+    if (inflateInit2(&inflateStream, inflateWindowBits) != Z_OK)
+        throw std::runtime_error("inflate init failed");
+    inflateReady = true;
+}
+
+void ZCodec::initDeflate(int level) {
+    if (deflateReady) {
+        if (deflateReset(&deflateStream) == Z_OK &&
+                (level == deflateLevel || deflateParams(&deflateStream, level, Z_DEFAULT_STRATEGY) == Z_OK)) {
+            deflateLevel = level;
+            return;
+        }
+        deflateEnd(&deflateStream);
+        deflateReady = false;
+    }
+    deflateStream.zalloc = Z_NULL;
+    deflateStream.zfree = Z_NULL;
+    deflateStream.opaque = Z_NULL;
+    deflateStream.avail_in = 0;
+    deflateStream.next_in = Z_NULL;
+    if (deflateInit2(&deflateStream, level, Z_DEFLATED, deflateWindowBits, deflateMemLevel, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("deflate init failed");
+    deflateReady = true;
+    deflateLevel = level;
+}
+
+/* Inflate gzip/zlib data
+ * @param charge: when set, the output stays charged to it after returning
+ * @throws std::runtime_error: on corrupted data, when output would exceed maxBytes or the memory budget
+ */
+std::string ZCodec::decompress(const char* data, size_t size, MemoryAccounting::Buffer* charge) {
+    if (size > maxBytes)
+        throw std::runtime_error("size may use more memory than intended when decompressing");
+    MemoryAccounting::StageScope stage(MemoryAccounting::Inflate);
+    MemoryAccounting::Buffer localCharge;
+    MemoryAccounting::Buffer& outputCharge = charge ? *charge : localCharge;
+    initInflate();
+    inflateStream.next_in = reinterpret_cast<z_const Bytef*>(data);
+    inflateStream.avail_in = static_cast<unsigned int>(size);
+
+    std::string output;
+    size_t sizeUncompressed = 0;
+    int ret;
+    do {
+        // grow geometrically, starting from twice the input
+        size_t resizeTo = std::max(output.size() * 2, sizeUncompressed + 2 * size + 1024);
+        if (resizeTo > maxBytes)
+            resizeTo = maxBytes;
+        if (resizeTo <= sizeUncompressed)
+            throw std::runtime_error("size of output string will use more memory then intended when decompressing");
+        // old and new storage coexist while the string grows
+        outputCharge.resize(output.size() + resizeTo);
+        MemoryAccounting::copied(output.size());
+        output.resize(resizeTo);
+        outputCharge.resize(resizeTo);
+        size_t chunk = std::min<size_t>(resizeTo - sizeUncompressed, UINT32_MAX);
+        inflateStream.next_out = reinterpret_cast<Bytef*>(&output[0] + sizeUncompressed);
+        inflateStream.avail_out = static_cast<unsigned int>(chunk);
+        ret = inflate(&inflateStream, Z_FINISH);
+        if (ret != Z_STREAM_END && ret != Z_OK && ret != Z_BUF_ERROR)
+            throw std::runtime_error(inflateStream.msg ? inflateStream.msg : "inflate failed");
+        sizeUncompressed += chunk - inflateStream.avail_out;
+        if (ret == Z_BUF_ERROR && inflateStream.avail_in == 0 && inflateStream.avail_out != 0)
+            throw std::runtime_error("unexpected end of compressed data");
+    } while (ret != Z_STREAM_END);
+    output.resize(sizeUncompressed);
+    return output;
+}
+
+/* Deflate data into gzip format
+ * @param charge: when set, the output stays charged to it after returning
+ * @throws std::runtime_error: when input is larger than maxBytes or output would exceed the memory budget
+ */
+std::string ZCodec::compress(const char* data, size_t size, int level, MemoryAccounting::Buffer* charge) {
+    if (size > maxBytes)
+        throw std::runtime_error("size may use more memory than intended when compressing");
+    MemoryAccounting::StageScope stage(MemoryAccounting::Deflate);
+    MemoryAccounting::Buffer localCharge;
+    MemoryAccounting::Buffer& outputCharge = charge ? *charge : localCharge;
+    initDeflate(level);
+    deflateStream.next_in = reinterpret_cast<z_const Bytef*>(data);
+    deflateStream.avail_in = static_cast<unsigned int>(size);
+
+    // deflateBound is an upper limit, one deflate call is enough
+    std::string output;
+    size_t bound = deflateBound(&deflateStream, static_cast<uLong>(size));
+    outputCharge.resize(bound);
+    output.resize(bound);
+    deflateStream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    deflateStream.avail_out = static_cast<unsigned int>(output.size());
+    if (deflate(&deflateStream, Z_FINISH) != Z_STREAM_END)
+        throw std::runtime_error(deflateStream.msg ? deflateStream.msg : "deflate failed");
+    output.resize(output.size() - deflateStream.avail_out);
+    return output;
+}
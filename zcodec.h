@@ -0,0 +1,45 @@
+#ifndef ZCODEC_H
+#define ZCODEC_H
+
+#include <gzip-cpp/config.hpp>
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <string>
+
+#include <memoryaccounting.h>
+
+/* gzip compression with persistent zlib streams
+ * Streams are initialized once and reset between uses, which avoids
+ * reallocating zlib state (~300 KB) for every archive processed.
+ * One codec must not be used by multiple threads at once, use local().
+ */
+class ZCodec
+{
+public:
+    ZCodec(size_t maxBytes = 1000000000); // refuse to produce more than 1GB by default
+    ~ZCodec();
+    ZCodec(ZCodec const&) = delete;
+    ZCodec& operator=(ZCodec const&) = delete;
+
+    std::string decompress(const char* data, size_t size, MemoryAccounting::Buffer* charge = nullptr);
+    std::string compress(const char* data, size_t size, int level = Z_DEFAULT_COMPRESSION,
+                         MemoryAccounting::Buffer* charge = nullptr);
+
+    // codec owned by the calling thread
+    static ZCodec& local();
+
+private:
+    void initInflate();
+    void initDeflate(int level);
+
+    z_stream inflateStream;
+    z_stream deflateStream;
+    bool inflateReady = false;
+    bool deflateReady = false;
+    int deflateLevel = Z_DEFAULT_COMPRESSION;
+    size_t maxBytes;
+};
+
+#endif // ZCODEC_H